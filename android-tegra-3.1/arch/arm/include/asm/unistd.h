@@ -407,6 +407,16 @@
 #define __NR_orientlock_write		(__NR_SYSCALL_BASE+378)
 #define __NR_orientunlock_read		(__NR_SYSCALL_BASE+379)
 #define __NR_orientunlock_write		(__NR_SYSCALL_BASE+380)
+#define __NR_get_orientation		(__NR_SYSCALL_BASE+381)
+#define __NR_orientlock_batch		(__NR_SYSCALL_BASE+382)
+#define __NR_orientunlock_batch		(__NR_SYSCALL_BASE+383)
+#define __NR_orientlock_tryread		(__NR_SYSCALL_BASE+384)
+#define __NR_orientlock_trywrite	(__NR_SYSCALL_BASE+385)
+#define __NR_orientlock_timedread	(__NR_SYSCALL_BASE+386)
+#define __NR_orientlock_timedwrite	(__NR_SYSCALL_BASE+387)
+#define __NR_orientlock_fd		(__NR_SYSCALL_BASE+388)
+#define __NR_set_orientation_batch	(__NR_SYSCALL_BASE+389)
+#define __NR_orientlock_demand		(__NR_SYSCALL_BASE+390)
 
 /*
  * The following SWIs are ARM private.
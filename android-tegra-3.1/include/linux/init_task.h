@@ -184,6 +184,8 @@ extern struct cred init_cred;
 		[PIDTYPE_SID]  = INIT_PID_LINK(PIDTYPE_SID),		\
 	},								\
 	.thread_group	= LIST_HEAD_INIT(tsk.thread_group),		\
+	.orient_locks	= LIST_HEAD_INIT(tsk.orient_locks),		\
+	.orient_locks_lock = __SPIN_LOCK_UNLOCKED(tsk.orient_locks_lock),\
 	.dirties = INIT_PROP_LOCAL_SINGLE(dirties),			\
 	INIT_IDS							\
 	INIT_PERF_EVENTS(tsk)						\
@@ -10,6 +10,7 @@
 #include <linux/slab.h>
 #include <linux/pid.h>
 #include <linux/sched.h>
+#include <linux/rbtree.h>
 
 
 /* Types for lock entry */
@@ -24,40 +25,125 @@
 #define MIN_AZIMUTH 0
 #define MAX_AZIMUTH 360
 
+/*
+ * Angles in dev_orientation and orientation_range are Q16 fixed
+ * point, i.e. degrees * ORIENT_ONE, so ranges can be narrower than
+ * a degree while the kernel only compares integers. The MIN/MAX
+ * constants above are whole degrees; use ORIENT_DEG() to convert.
+ */
+#define ORIENT_FRAC_BITS 16
+#define ORIENT_ONE (1 << ORIENT_FRAC_BITS)
+#define ORIENT_DEG(deg) ((deg) * ORIENT_ONE)
+
 struct dev_orientation {
 	int azimuth; /* angle between the magnetic north
 	                and the Y axis, around the Z axis
-	                (0<=azimuth<360)
+	                (0<=azimuth<360), Q16
 	                0=North, 90=East, 180=South, 270=West */
-	int pitch;   /* rotation around the X-axis: -180<=pitch<=180 */
+	int pitch;   /* rotation around the X-axis: -180<=pitch<=180, Q16 */
 	int roll;    /* rotation around Y-axis: +Y == -roll,
-	                -90<=roll<=90 */
+	                -90<=roll<=90, Q16 */
 };
 
-struct dev_orientation current_orient;
-
 struct orientation_range {
 	struct dev_orientation orient;  /* device orientation */
-	unsigned int azimuth_range;     /* +/- degrees around Z-axis */
-	unsigned int pitch_range;       /* +/- degrees around X-axis */
-	unsigned int roll_range;        /* +/- degrees around Y-axis */
+	unsigned int azimuth_range;     /* +/- Q16 degrees around Z-axis */
+	unsigned int pitch_range;       /* +/- Q16 degrees around X-axis */
+	unsigned int roll_range;        /* +/- Q16 degrees around Y-axis */
+};
+
+/* Axes, bounds and policies, shared with the grant pass engine */
+#include <linux/orientation_core.h>
+
+/* One timestamped sensor reading, see set_orientation_batch */
+struct orientation_sample {
+	s64 timestamp; /* nanoseconds, as reported by the sensor HAL */
+	struct dev_orientation orient;
+};
+
+/* Most samples a single set_orientation_batch call may carry */
+#define ORIENT_SAMPLES_MAX 16
+
+/* What the pending lock requests need, see orientlock_demand */
+struct orientlock_demand {
+	int waiters; /* lock requests waiting to be granted */
+	/* narrowest +/- range waited on per axis, Q16; UINT_MAX if none */
+	unsigned int min_range[ORIENT_AXES];
+};
+
+/*
+ * A value on one axis where a waiting range starts or ends, indexed
+ * in a per-axis tree so the grant pass can tell which orientations
+ * would not change any in-range test.
+ */
+struct orient_edge {
+	struct rb_node node;
+	int value;
+};
+
+/* One element of a batched lock or unlock request */
+struct orientlock_request {
+	struct orientation_range range;
+	int type; /* READER_ENTRY or WRITER_ENTRY */
+};
+
+/* Most ranges a single batched request may carry */
+#define ORIENTLOCK_BATCH_MAX 32
+
+/*
+ * One per distinct orientation_range with pending or granted locks,
+ * hashed on the whole range. Keeps the per-range reader count and
+ * writer flag so grant decisions do not have to scan every holder.
+ * While it has holders the range is also in an interval tree keyed
+ * on azimuth, so locks on overlapping ranges can be found.
+ */
+struct granted_bucket;
+struct waiter_shard;
+
+struct granted_range {
+	struct hlist_node hash;
+	struct granted_bucket *bucket; /* hash bucket, holds its lock */
+	struct orientation_range range;
+	struct orientation_bounds bounds; /* range, normalized */
+	struct rb_node node; /* Granted interval tree */
+	int subtree_max_hi; /* largest azimuth_lo + span in this subtree */
+	struct list_head holders; /* granted lock_entry's */
+	atomic_t readers; /* number of granted read locks */
+	int writer; /* 1 if a write lock is granted */
+	int refs; /* waiters and holders using this range */
+	unsigned long requests; /* lock requests made on this range */
+	unsigned long grants; /* locks granted on this range */
 };
 
 struct lock_entry {
-	struct orientation_range *range;
+	struct orientation_range range; /* copied in from userspace */
+	struct orient_waiter ow; /* bounds, type, order, bypasses */
+	struct granted_range *grange;
+	struct waiter_shard *shard; /* waiter queue it was put on */
 	atomic_t granted;
+	wait_queue_head_t wait; /* only this request's task sleeps here */
 	struct list_head list; /* Waiters list */
-	struct list_head granted_list;
-	int type; /* 0 for read 1 for write */
+	struct list_head granted_list; /* grange->holders */
+	struct rb_node node; /* Waiters interval tree, keyed on azimuth */
+	int subtree_max_hi; /* largest azimuth_lo + span in this subtree */
+	/* start and end of each axis interval, see entry_edge() */
+	struct orient_edge edges[2 * ORIENT_AXES];
+	struct list_head match; /* scratch list for a grant pass */
+	struct list_head batch; /* ring of requests granted together */
+	int batch_head; /* the one of its batch the owner waits on */
+	struct list_head starved; /* starved_list, once bypassed enough */
 	int pid; /* pid of process that runs this */
+	struct file *file; /* orientlock fd owning this request, if any */
+	struct list_head task_list; /* owner's task_struct->orient_locks */
+	struct task_struct *owner; /* task tracking it, NULL for fd locks */
+	u64 queued_at; /* local_clock() when queued, for statistics */
+	u64 granted_at; /* local_clock() when granted */
 };
+extern int sysctl_orientlock_policy;
+extern int sysctl_orientlock_max_bypass;
+extern int sysctl_orientlock_deadband[ORIENT_AXES];
 
-LIST_HEAD(waiters_list);
-LIST_HEAD(granted_list);
-
-spinlock_t WAITERS_LOCK;
-spinlock_t GRANTED_LOCK;
-spinlock_t SET_LOCK;
+/* Releases every orientation lock tsk holds or waits for */
+extern void exit_orientation_locks(struct task_struct *tsk);
 
-DECLARE_WAIT_QUEUE_HEAD(sleepers);
 #endif /* _LINUX_ORIENTATION_H */
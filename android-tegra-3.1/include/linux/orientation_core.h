@@ -0,0 +1,467 @@
+/*
+ * Orientation lock engine core
+ *
+ * The range arithmetic and the grant pass of kernel/orientation.c,
+ * kept free of kernel-only types and locking so the same code also
+ * builds in userspace: test/orient_model.c runs it on a host to
+ * model the lock engine without booting the emulator. The pass
+ * works on struct orient_waiter, embedded in each request; the
+ * caller owns the containers and their locks and reaches them
+ * through struct orient_pass_ops.
+ *
+ * Include after struct dev_orientation, struct orientation_range,
+ * the Q16 macros and READER_ENTRY/WRITER_ENTRY: linux/orientation.h
+ * does so in the kernel, test/orient_lock.h supplies them to
+ * userspace.
+ */
+
+#ifndef _LINUX_ORIENTATION_CORE_H
+#define _LINUX_ORIENTATION_CORE_H
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/types.h>
+#else
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int64_t s64;
+#endif
+
+#define ORIENT_TURN ORIENT_DEG(360)
+
+/* Axes of a dev_orientation, in declaration order */
+#define ORIENT_AZIMUTH_AXIS 0
+#define ORIENT_PITCH_AXIS 1
+#define ORIENT_ROLL_AXIS 2
+#define ORIENT_AXES 3
+
+/*
+ * Grant pass policies, selected through kernel.orientlock_policy.
+ * Under every policy a waiter that has been overtaken
+ * kernel.orientlock_max_bypass times by newer conflicting requests
+ * is no longer overtaken.
+ */
+#define ORIENTLOCK_FIFO 0 /* arrival order */
+#define ORIENTLOCK_WRITER_PREF 1 /* writers before readers */
+#define ORIENTLOCK_READER_PREF 2 /* readers before writers */
+
+/*
+ * An orientation_range normalized once, when the request is made.
+ * Each axis accepts [lo, lo + span]; the azimuth interval may run
+ * past ORIENT_TURN, in which case it wraps around north. A span of
+ * UINT_MAX accepts any value.
+ */
+struct orientation_bounds {
+	int azimuth_lo; /* 0 <= azimuth_lo < ORIENT_TURN */
+	unsigned int azimuth_span; /* < ORIENT_TURN */
+	int pitch_lo;
+	unsigned int pitch_span;
+	int roll_lo;
+	unsigned int roll_span;
+};
+
+/* The part of a lock request that grant decisions are made on */
+struct orient_waiter {
+	struct orientation_bounds bounds; /* range, normalized */
+	int type; /* READER_ENTRY or WRITER_ENTRY */
+	unsigned long seq; /* arrival order, keeps grants FIFO */
+	int bypassed; /* grant passes in which it was overtaken */
+	int overtaken; /* overtaken during the current grant pass */
+};
+
+/* A box of orientations, see grant_cell */
+struct orient_cell {
+	int lo[ORIENT_AXES]; /* lowest value inside */
+	int hi[ORIENT_AXES]; /* first value past it */
+};
+
+/* Brings an azimuth into [0, ORIENT_TURN) */
+static inline int normalize_azimuth(int azimuth)
+{
+	azimuth %= ORIENT_TURN;
+	if (azimuth < 0)
+		azimuth += ORIENT_TURN;
+	return azimuth;
+}
+
+/* A zero +/- range accepts any value on that axis */
+static inline void set_axis_bounds(int *lo, unsigned int *span, int basis,
+				   unsigned int range)
+{
+	if (range == 0 || range > INT_MAX / 2) {
+		*lo = 0;
+		*span = UINT_MAX;
+	} else {
+		*lo = basis - (int) range;
+		*span = 2 * range;
+	}
+}
+
+/*
+ * Precomputes the bounds a range accepts, so matching a new
+ * orientation does not redo the basis +/- range arithmetic for
+ * every waiter. Azimuth intervals wrap around north; one that
+ * covers the whole circle accepts any azimuth.
+ */
+static inline void set_range_bounds(struct orientation_bounds *bounds,
+				    struct orientation_range *range)
+{
+	if (range->azimuth_range == 0 ||
+	    range->azimuth_range >= ORIENT_TURN / 2) {
+		bounds->azimuth_lo = 0;
+		bounds->azimuth_span = ORIENT_TURN - 1;
+	} else {
+		bounds->azimuth_lo = normalize_azimuth(range->orient.azimuth -
+						(int) range->azimuth_range);
+		bounds->azimuth_span = 2 * range->azimuth_range;
+	}
+	set_axis_bounds(&bounds->pitch_lo, &bounds->pitch_span,
+			range->orient.pitch, range->pitch_range);
+	set_axis_bounds(&bounds->roll_lo, &bounds->roll_span,
+			range->orient.roll, range->roll_range);
+}
+
+/*
+ * Returns 1 if a normalized orientation lies within bounds. Each
+ * axis is one unsigned comparison against the precomputed span,
+ * combined without branching.
+ */
+static inline int in_bounds(struct orientation_bounds *bounds,
+			    struct dev_orientation *orient)
+{
+	int azimuth = orient->azimuth - bounds->azimuth_lo;
+
+	if (azimuth < 0) /* wrapped past north */
+		azimuth += ORIENT_TURN;
+
+	return ((unsigned int) azimuth <= bounds->azimuth_span) &
+		((unsigned int) (orient->pitch - bounds->pitch_lo) <=
+		 bounds->pitch_span) &
+		((unsigned int) (orient->roll - bounds->roll_lo) <=
+		 bounds->roll_span);
+}
+
+/* Returns 1 if [lo1, lo1 + span1] and [lo2, lo2 + span2] intersect */
+static inline int axis_overlaps(int lo1, unsigned int span1, int lo2,
+				unsigned int span2)
+{
+	return ((unsigned int) lo2 - (unsigned int) lo1 <= span1) |
+		((unsigned int) lo1 - (unsigned int) lo2 <= span2);
+}
+
+/*
+ * Returns 1 if some orientation lies within both bounds, i.e. the
+ * two ranges overlap on every axis. Azimuth differences are taken
+ * around the circle.
+ */
+static inline int bounds_overlap(struct orientation_bounds *one,
+				 struct orientation_bounds *two)
+{
+	int diff = two->azimuth_lo - one->azimuth_lo;
+
+	if (diff < 0)
+		diff += ORIENT_TURN;
+
+	return ((unsigned int) diff <= one->azimuth_span ||
+		(unsigned int) (ORIENT_TURN - diff) % ORIENT_TURN <=
+		two->azimuth_span) &&
+		axis_overlaps(one->pitch_lo, one->pitch_span,
+			      two->pitch_lo, two->pitch_span) &&
+		axis_overlaps(one->roll_lo, one->roll_span,
+			      two->roll_lo, two->roll_span);
+}
+
+/*
+ * Finds where in_bounds() can change for bounds: edge 2 * axis is
+ * the first value of the axis interval, 2 * axis + 1 the first
+ * value past it. Azimuth edges are kept within [0, ORIENT_TURN).
+ * Returns 0 if the axis accepts any value and so has no edges.
+ */
+static inline int bounds_edge(struct orientation_bounds *bounds, int edge,
+			      int *value)
+{
+	unsigned int span;
+	int lo;
+
+	switch (edge / 2) {
+	case ORIENT_AZIMUTH_AXIS:
+		if (bounds->azimuth_span >= ORIENT_TURN - 1)
+			return 0;
+		lo = bounds->azimuth_lo;
+		span = bounds->azimuth_span;
+		break;
+	case ORIENT_PITCH_AXIS:
+		lo = bounds->pitch_lo;
+		span = bounds->pitch_span;
+		break;
+	default:
+		lo = bounds->roll_lo;
+		span = bounds->roll_span;
+		break;
+	}
+	if (span == UINT_MAX)
+		return 0;
+
+	*value = (edge & 1) ? lo + (int) span + 1 : lo;
+	if (edge / 2 == ORIENT_AZIMUTH_AXIS)
+		*value = normalize_azimuth(*value);
+	return 1;
+}
+
+/* Returns 1 if the two requests may not be held at the same time */
+static inline int waiters_conflict(struct orient_waiter *one,
+				   struct orient_waiter *two)
+{
+	return (one->type == WRITER_ENTRY || two->type == WRITER_ENTRY) &&
+		bounds_overlap(&one->bounds, &two->bounds);
+}
+
+/* Returns 1 if one was queued before two */
+static inline int waiter_older(struct orient_waiter *one,
+			       struct orient_waiter *two)
+{
+	return (long) (one->seq - two->seq) < 0;
+}
+
+/*
+ * Returns 1 if orient lies within cell widened by deadband on each
+ * side, i.e. it has not crossed any waiter's range edge by more than
+ * the deadband. An azimuth cell spanning a full turn always matches.
+ */
+static inline int in_cell(struct orient_cell *cell,
+			  struct dev_orientation *orient, int *deadband)
+{
+	int value[ORIENT_AXES] = { orient->azimuth, orient->pitch,
+				   orient->roll };
+	int axis;
+
+	for (axis = 0; axis < ORIENT_AXES; axis++) {
+		s64 lo = (s64) cell->lo[axis] - deadband[axis];
+		s64 hi = (s64) cell->hi[axis] + deadband[axis];
+
+		if (axis == ORIENT_AZIMUTH_AXIS) {
+			if (hi - lo >= ORIENT_TURN)
+				continue;
+			/* lo and hi are within a turn or two of north here */
+			if (normalize_azimuth(value[axis] - (int) lo) >=
+			    (int) (hi - lo))
+				return 0;
+		} else if (value[axis] < lo || value[axis] >= hi) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Orders two waiters for a grant pass under policy: readers or
+ * writers first if it prefers one, then by arrival sequence.
+ */
+static inline int policy_cmp(int policy, struct orient_waiter *one,
+			     struct orient_waiter *two)
+{
+	if (one->type != two->type) {
+		if (policy == ORIENTLOCK_WRITER_PREF)
+			return one->type == WRITER_ENTRY ? -1 : 1;
+		if (policy == ORIENTLOCK_READER_PREF)
+			return one->type == READER_ENTRY ? -1 : 1;
+	}
+
+	if (one->seq == two->seq)
+		return 0;
+	return waiter_older(one, two) ? -1 : 1;
+}
+
+/*
+ * The containers a grant pass runs over. pass is the caller's
+ * context for the pass, handed back to every callback. The walks
+ * return the waiter after prev, or the first one if prev is NULL,
+ * and NULL at the end. The callers' ops tables are constant, so the
+ * compiler can call them directly once the pass is inlined.
+ */
+struct orient_pass_ops {
+	/*
+	 * Takes the next waiter to consider, in policy order, off the
+	 * waiters in range; it stays among the pass's pending waiters
+	 * unless granted. Returns NULL once every one was considered.
+	 */
+	struct orient_waiter *(*next_match)(void *pass);
+	/* Walks the waiters of the pass that are not granted */
+	struct orient_waiter *(*next_pending)(void *pass,
+					      struct orient_waiter *prev);
+	/* Walks every starved waiter, in range or not */
+	struct orient_waiter *(*next_starved)(void *pass,
+					      struct orient_waiter *prev);
+	/* Walks the rest of w's batch; may be NULL if there are none */
+	struct orient_waiter *(*next_member)(void *pass,
+					     struct orient_waiter *w,
+					     struct orient_waiter *prev);
+	/* Returns 1 if a held lock conflicts with w */
+	int (*holders_conflict)(void *pass, struct orient_waiter *w);
+	/* Makes w a holder and takes it off the waiters and the pass */
+	void (*grant)(void *pass, struct orient_waiter *w);
+	/* Hands the granted w and its batch to their owner; may be NULL */
+	void (*publish)(void *pass, struct orient_waiter *w);
+	/* w was overtaken too often: puts it among the starved */
+	void (*starve)(void *pass, struct orient_waiter *w);
+	/*
+	 * Raises *below to the largest waiter edge on axis <= value
+	 * and lowers *above to the smallest one > value, see
+	 * bounds_edge().
+	 */
+	void (*edges_around)(void *pass, int axis, int value, int *below,
+			     int *above);
+};
+
+/*
+ * Returns 1 if granting w would overtake an older, conflicting,
+ * in range waiter that has been overtaken too often already.
+ */
+static inline int overtakes_starved(const struct orient_pass_ops *ops,
+				    void *pass, struct orient_waiter *w,
+				    struct dev_orientation *orient)
+{
+	struct orient_waiter *starved = NULL;
+
+	while ((starved = ops->next_starved(pass, starved)) != NULL) {
+		if (waiter_older(starved, w) &&
+		    in_bounds(&starved->bounds, orient) &&
+		    waiters_conflict(starved, w))
+			return 1;
+	}
+	return 0;
+}
+
+/* Returns 1 if no held lock or starved waiter stands in w's way */
+static inline int can_grant(const struct orient_pass_ops *ops, void *pass,
+			    struct orient_waiter *w,
+			    struct dev_orientation *orient)
+{
+	return !ops->holders_conflict(pass, w) &&
+		!overtakes_starved(ops, pass, w, orient);
+}
+
+/* Flags the older pending waiters that w's grant overtook */
+static inline void mark_overtaken(const struct orient_pass_ops *ops,
+				  void *pass, struct orient_waiter *w)
+{
+	struct orient_waiter *waiter = NULL;
+
+	while ((waiter = ops->next_pending(pass, waiter)) != NULL) {
+		if (waiter_older(waiter, w) && waiters_conflict(waiter, w))
+			waiter->overtaken = 1;
+	}
+}
+
+/*
+ * Grants the lock to a waiter already known to be in range, if it
+ * can be granted. A request that is part of a batch is granted only
+ * together with the rest of its batch, once every member is in
+ * range and grantable. The grants are published only after every
+ * waiter they overtook is flagged, as the owner may release them as
+ * soon as it is handed them.
+ * Returns 1 if the request was granted.
+ */
+static inline int process_waiter(const struct orient_pass_ops *ops,
+				 void *pass, struct orient_waiter *w,
+				 struct dev_orientation *orient)
+{
+	struct orient_waiter *member = NULL;
+
+	if (!can_grant(ops, pass, w, orient))
+		return 0;
+
+	while (ops->next_member &&
+	       (member = ops->next_member(pass, w, member)) != NULL) {
+		if (!in_bounds(&member->bounds, orient) ||
+		    !can_grant(ops, pass, member, orient))
+			return 0;
+	}
+
+	while (ops->next_member &&
+	       (member = ops->next_member(pass, w, member)) != NULL) {
+		ops->grant(pass, member);
+		mark_overtaken(ops, pass, member);
+	}
+	ops->grant(pass, w);
+	mark_overtaken(ops, pass, w);
+	if (ops->publish)
+		ops->publish(pass, w);
+	return 1;
+}
+
+/*
+ * Ends a grant pass: every pending waiter that was overtaken during
+ * it counts one more bypass, and is starved once it reaches
+ * max_bypass.
+ */
+static inline void account_bypasses(const struct orient_pass_ops *ops,
+				    void *pass, int max_bypass)
+{
+	struct orient_waiter *waiter = NULL;
+
+	while ((waiter = ops->next_pending(pass, waiter)) != NULL) {
+		if (!waiter->overtaken)
+			continue;
+		waiter->overtaken = 0;
+		if (++waiter->bypassed >= max_bypass)
+			ops->starve(pass, waiter);
+	}
+}
+
+/*
+ * Grant pass: considers the waiters in range of orient in the order
+ * next_match() hands them out, then accounts the bypasses.
+ * Returns the number of requests granted, batches counting once.
+ */
+static inline int grant_waiters(const struct orient_pass_ops *ops,
+				void *pass, struct dev_orientation *orient,
+				int max_bypass)
+{
+	struct orient_waiter *w;
+	int granted = 0;
+
+	while ((w = ops->next_match(pass)) != NULL)
+		granted += process_waiter(ops, pass, w, orient);
+	account_bypasses(ops, pass, max_bypass);
+	return granted;
+}
+
+/*
+ * Computes the box of orientations around orient that no waiter's
+ * range starts or ends in. Azimuth wraps, so past the last edge the
+ * box continues from the first one, one turn on.
+ */
+static inline void compute_cell(const struct orient_pass_ops *ops,
+				void *pass, struct dev_orientation *orient,
+				struct orient_cell *cell)
+{
+	int value[ORIENT_AXES] = { orient->azimuth, orient->pitch,
+				   orient->roll };
+	int first = INT_MAX, last = INT_MIN, unused;
+	int axis;
+
+	for (axis = 0; axis < ORIENT_AXES; axis++) {
+		cell->lo[axis] = INT_MIN;
+		cell->hi[axis] = INT_MAX;
+		ops->edges_around(pass, axis, value[axis], &cell->lo[axis],
+				  &cell->hi[axis]);
+	}
+
+	/* Azimuth edges lie in [0, ORIENT_TURN) */
+	unused = INT_MIN;
+	ops->edges_around(pass, ORIENT_AZIMUTH_AXIS, -1, &unused, &first);
+	if (first == INT_MAX)
+		return;
+	unused = INT_MAX;
+	ops->edges_around(pass, ORIENT_AZIMUTH_AXIS, INT_MAX, &last, &unused);
+
+	if (cell->lo[ORIENT_AZIMUTH_AXIS] == INT_MIN)
+		cell->lo[ORIENT_AZIMUTH_AXIS] = last - ORIENT_TURN;
+	if (cell->hi[ORIENT_AZIMUTH_AXIS] == INT_MAX)
+		cell->hi[ORIENT_AZIMUTH_AXIS] = first + ORIENT_TURN;
+}
+
+#endif /* _LINUX_ORIENTATION_CORE_H */
@@ -1502,6 +1502,9 @@ struct task_struct {
 	struct list_head pi_state_list;
 	struct futex_pi_state *pi_state_cache;
 #endif
+	/* orientation locks held or awaited, released at exit */
+	struct list_head orient_locks;
+	spinlock_t orient_locks_lock; /* protects orient_locks */
 #ifdef CONFIG_PERF_EVENTS
 	struct perf_event_context *perf_event_ctxp[perf_nr_task_contexts];
 	struct mutex perf_event_mutex;
@@ -0,0 +1,110 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM orientation
+
+#if !defined(_TRACE_ORIENTATION_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_ORIENTATION_H
+
+#include <linux/orientation.h>
+#include <linux/tracepoint.h>
+
+/*
+ * Tracepoint for a new orientation pushed by orientd:
+ */
+TRACE_EVENT(orientation_set,
+
+	TP_PROTO(struct dev_orientation *orient),
+
+	TP_ARGS(orient),
+
+	TP_STRUCT__entry(
+		__field(	int,	azimuth		)
+		__field(	int,	pitch		)
+		__field(	int,	roll		)
+	),
+
+	TP_fast_assign(
+		__entry->azimuth	= orient->azimuth;
+		__entry->pitch		= orient->pitch;
+		__entry->roll		= orient->roll;
+	),
+
+	TP_printk("azimuth=%d pitch=%d roll=%d",
+		  __entry->azimuth, __entry->pitch, __entry->roll)
+);
+
+/*
+ * Tracepoints for the life of a single lock request:
+ */
+DECLARE_EVENT_CLASS(orientlock,
+
+	TP_PROTO(struct lock_entry *lock),
+
+	TP_ARGS(lock),
+
+	TP_STRUCT__entry(
+		__field(	void *,		lock		)
+		__field(	int,		pid		)
+		__field(	int,		type		)
+		__field(	int,		azimuth		)
+		__field(	int,		pitch		)
+		__field(	int,		roll		)
+		__field(	unsigned int,	azimuth_range	)
+		__field(	unsigned int,	pitch_range	)
+		__field(	unsigned int,	roll_range	)
+	),
+
+	TP_fast_assign(
+		__entry->lock		= lock;
+		__entry->pid		= lock->pid;
+		__entry->type		= lock->ow.type;
+		__entry->azimuth	= lock->range.orient.azimuth;
+		__entry->pitch		= lock->range.orient.pitch;
+		__entry->roll		= lock->range.orient.roll;
+		__entry->azimuth_range	= lock->range.azimuth_range;
+		__entry->pitch_range	= lock->range.pitch_range;
+		__entry->roll_range	= lock->range.roll_range;
+	),
+
+	TP_printk("lock=%p pid=%d %s azimuth=%d+/-%u pitch=%d+/-%u "
+		  "roll=%d+/-%u",
+		  __entry->lock, __entry->pid,
+		  __entry->type == WRITER_ENTRY ? "write" : "read",
+		  __entry->azimuth, __entry->azimuth_range,
+		  __entry->pitch, __entry->pitch_range,
+		  __entry->roll, __entry->roll_range)
+);
+
+/* Request queued on the waiters tree */
+DEFINE_EVENT(orientlock, orientlock_enqueue,
+	TP_PROTO(struct lock_entry *lock),
+	TP_ARGS(lock));
+
+/* Request granted, by a grant pass or a trylock */
+DEFINE_EVENT(orientlock, orientlock_grant,
+	TP_PROTO(struct lock_entry *lock),
+	TP_ARGS(lock));
+
+/* Waiting task running again after its grant */
+DEFINE_EVENT(orientlock, orientlock_wakeup,
+	TP_PROTO(struct lock_entry *lock),
+	TP_ARGS(lock));
+
+/* Queued request withdrawn on timeout, signal or fd close */
+DEFINE_EVENT(orientlock, orientlock_cancel,
+	TP_PROTO(struct lock_entry *lock),
+	TP_ARGS(lock));
+
+/* Granted lock released */
+DEFINE_EVENT(orientlock, orientlock_release,
+	TP_PROTO(struct lock_entry *lock),
+	TP_ARGS(lock));
+
+/* Granted lock reclaimed from a task that died holding it */
+DEFINE_EVENT(orientlock, orientlock_reclaim,
+	TP_PROTO(struct lock_entry *lock),
+	TP_ARGS(lock));
+
+#endif /* _TRACE_ORIENTATION_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -51,6 +51,7 @@
 #include <trace/events/sched.h>
 #include <linux/hw_breakpoint.h>
 #include <linux/oom.h>
+#include <linux/orientation.h>
 
 #include <asm/uaccess.h>
 #include <asm/unistd.h>
@@ -981,6 +982,7 @@ NORET_TYPE void do_exit(long code)
 
 	exit_sem(tsk);
 	exit_shm(tsk);
+	exit_orientation_locks(tsk);
 	exit_files(tsk);
 	exit_fs(tsk);
 	check_stack_usage();
@@ -1296,6 +1296,8 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	INIT_LIST_HEAD(&p->pi_state_list);
 	p->pi_state_cache = NULL;
 #endif
+	INIT_LIST_HEAD(&p->orient_locks);
+	spin_lock_init(&p->orient_locks_lock);
 	/*
 	 * sigaltstack should be cleared when sharing the same VM
 	 */
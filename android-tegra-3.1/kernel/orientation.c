@@ -2,6 +2,203 @@
 #include <linux/kernel.h>
 #include <linux/uaccess.h>
 #include <linux/syscalls.h>
+#include <linux/list_sort.h>
+#include <linux/jhash.h>
+#include <linux/seqlock.h>
+#include <linux/anon_inodes.h>
+#include <linux/file.h>
+#include <linux/poll.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/orientation.h>
+
+/*
+ * The last orientation pushed by orientd. It is only written by
+ * set_orientation under SET_LOCK and is published through
+ * orient_seq, so readers take no lock and retry on a torn read.
+ */
+static struct dev_orientation current_orient;
+static seqcount_t orient_seq = SEQCNT_ZERO;
+
+/*
+ * Timestamp of the newest sample set_orientation_batch published,
+ * so samples that arrive late are not published over newer ones.
+ * Protected by SET_LOCK.
+ */
+static s64 current_stamp = LLONG_MIN;
+
+/*
+ * Table of granted_range's, hashed on the full orientation_range.
+ * Each bucket has its own lock, which protects its chain and, for
+ * the ranges on it, the reference counts, request statistics and
+ * holders lists. Requests and unlocks on different ranges therefore
+ * do not share a lock.
+ */
+#define GRANTED_HASH_BITS 6
+#define GRANTED_HASH_SIZE (1 << GRANTED_HASH_BITS)
+struct granted_bucket {
+	spinlock_t lock;
+	struct hlist_head head;
+} ____cacheline_aligned_in_smp;
+static struct granted_bucket granted_table[GRANTED_HASH_SIZE];
+
+/*
+ * Ranges with at least one granted lock, see granted_tree_conflict().
+ * GRANTED_LOCK protects the tree and the writer flags. Reader counts
+ * are atomic and only take GRANTED_LOCK to go from or to zero, which
+ * is when a range enters or leaves the tree; releasing one of several
+ * read locks takes no global lock at all.
+ */
+static struct rb_root granted_tree = RB_ROOT;
+
+/*
+ * Every lock request is allocated from this cache; a granted_range is
+ * only allocated by the first request on its range.
+ */
+static struct kmem_cache *lock_entry_cachep;
+
+/*
+ * Pending lock requests are queued on one of WAITER_SHARDS shards,
+ * picked by the CPU the request is made on, so concurrent requests
+ * do not bounce a single lock. Each shard indexes its waiters by an
+ * interval tree (augmented rbtree, see arch/x86/mm/pat_rbtree.c)
+ * ordered on the low end of their azimuth interval. Every node
+ * caches the largest high end found in its subtree, so a new
+ * orientation only visits the waiters whose azimuth interval
+ * contains it; pitch and roll are then filtered with in_bounds().
+ * Intervals that wrap around north end past ORIENT_TURN, so they are
+ * found by stabbing the tree a second time at azimuth + ORIENT_TURN.
+ *
+ * A shard's lock protects everything in it. The grant pass takes
+ * every shard lock, in index order, and combines their matches;
+ * waiters_seq keeps arrival order comparable across shards.
+ */
+#define WAITER_SHARDS 4
+struct waiter_shard {
+	spinlock_t lock;
+	struct list_head list;
+	struct rb_root tree;
+	struct rb_root edges[ORIENT_AXES]; /* see edges_insert() */
+	struct list_head starved; /* see pass_starve() */
+	atomic_t nr_waiters; /* on list; read without the lock */
+} ____cacheline_aligned_in_smp;
+static struct waiter_shard waiter_shards[WAITER_SHARDS];
+static atomic_long_t waiters_seq = ATOMIC_LONG_INIT(0);
+
+/*
+ * What orientlock_demand last reported, recomputed only once
+ * demand_changed says a waiter was queued or left the queue since.
+ * demand_cache is protected by DEMAND_LOCK.
+ */
+static struct orientlock_demand demand_cache;
+static atomic_t demand_changed = ATOMIC_INIT(1);
+static DEFINE_SPINLOCK(DEMAND_LOCK);
+
+/*
+ * Grant pass fairness. The policy picks the order matched waiters
+ * are considered in; a waiter overtaken by newer conflicting grants
+ * in sysctl_orientlock_max_bypass passes goes on its shard's starved
+ * list, and from then on nothing newer that conflicts with it is
+ * granted while it is in range. A trylock that overtakes waiters
+ * counts against them the same way.
+ */
+int sysctl_orientlock_policy = ORIENTLOCK_FIFO;
+int sysctl_orientlock_max_bypass = 4;
+
+/*
+ * Change detection. Every waiter puts the edges of its axis
+ * intervals in its shard's edge trees. After a grant pass,
+ * grant_cell is the box around the orientation it used in which
+ * no edge lies, so no waiter's in_bounds() result can change while
+ * the device stays inside it. set_orientation only schedules a pass
+ * once a sample leaves the box by more than the per-axis deadband (Q16),
+ * or once waiters_changed says the waiters or holders changed.
+ * grant_cell is protected by SET_LOCK.
+ */
+int sysctl_orientlock_deadband[ORIENT_AXES];
+static struct orient_cell grant_cell;
+static int grant_cell_valid;
+static atomic_t waiters_changed = ATOMIC_INIT(0);
+
+static DEFINE_SPINLOCK(GRANTED_LOCK);
+static DEFINE_SPINLOCK(SET_LOCK);
+
+static struct workqueue_struct *orient_wq;
+static void orientation_grant_pass(struct work_struct *work);
+static DECLARE_WORK(grant_work, orientation_grant_pass);
+
+/*
+ * The waiters or holders changed in a way that can let a waiter in:
+ * runs a grant pass against the orientation already published,
+ * rather than waiting for the next sample, which orientd may send
+ * only an idle period later.
+ */
+static void kick_grant_pass(void)
+{
+	atomic_set(&waiters_changed, 1);
+	queue_work(orient_wq, &grant_work);
+}
+
+/*
+ * Lock statistics, reported through /proc/orientlock. Counters are
+ * per-CPU and only ever incremented locally, so they cost a few
+ * non-atomic adds on the hot paths and are summed when read.
+ * Histogram bucket i counts values in [2^(i-1), 2^i); bucket 0
+ * counts zero and the last bucket everything above.
+ */
+#define ORIENT_HIST_BUCKETS 24
+
+struct orientlock_stats {
+	unsigned long set_orientation; /* sensor updates received */
+	unsigned long coalesced; /* updates folded into a queued pass */
+	unsigned long passes; /* grant passes run */
+	unsigned long suppressed; /* updates that needed no pass */
+	unsigned long waits; /* requests that were queued */
+	unsigned long grants; /* locks granted */
+	unsigned long releases; /* locks released */
+	unsigned long scanned; /* waiters_tree nodes visited */
+	unsigned long matched; /* waiters in range across passes */
+	unsigned long wait_hist[ORIENT_HIST_BUCKETS]; /* usecs */
+	unsigned long hold_hist[ORIENT_HIST_BUCKETS]; /* usecs */
+	unsigned long scan_hist[ORIENT_HIST_BUCKETS]; /* nodes per pass */
+};
+
+static DEFINE_PER_CPU(struct orientlock_stats, orientlock_stats);
+
+#define orient_stat_add(field, val) this_cpu_add(orientlock_stats.field, val)
+#define orient_stat_inc(field) orient_stat_add(field, 1)
+
+static int orient_hist_bucket(u64 val)
+{
+	int bucket = fls64(val);
+
+	if (bucket >= ORIENT_HIST_BUCKETS)
+		bucket = ORIENT_HIST_BUCKETS - 1;
+	return bucket;
+}
+
+/* Counts the time since start, in usecs, into the given histogram */
+#define orient_stat_time(hist, start) \
+	orient_stat_inc(hist[orient_hist_bucket( \
+		div_u64(local_clock() - (start), NSEC_PER_USEC))])
+
+/* Returns a consistent snapshot of current_orient without locking */
+static struct dev_orientation read_current_orient(void)
+{
+	struct dev_orientation orient;
+	unsigned seq;
+
+	do {
+		seq = read_seqcount_begin(&orient_seq);
+		orient = current_orient;
+	} while (read_seqcount_retry(&orient_seq, seq));
+
+	return orient;
+}
 
 static void print_orientation(struct dev_orientation orient)
 {
@@ -26,384 +223,1753 @@ static int range_equals(struct orientation_range *range,
 		orient_equals(range->orient, target->orient));
 }
 
-static int generic_search_list(struct orientation_range *target,
-			struct list_head *list, int type)
+/*
+ * Allocates a lock request of the given type for the calling task,
+ * copying its range in from userspace.
+ * Returns the new entry or an ERR_PTR.
+ */
+static struct lock_entry *
+alloc_lock_entry(struct orientation_range __user *orient, int type)
 {
-	int flag = 1;
-	struct list_head *current_item;
-	list_for_each(current_item, list) {
-		struct lock_entry *entry;
-		if (list == &waiters_list)
-			entry = list_entry(current_item,
-					struct lock_entry, list);
-		else
-			entry = list_entry(current_item, struct lock_entry,
-					   granted_list);
-		if (entry->type == type &&
-		    range_equals(entry->range, target)) {
-			flag = 0;
-			break;
-		}
+	struct lock_entry *entry;
+
+	entry = kmem_cache_alloc(lock_entry_cachep, GFP_KERNEL);
+	if (entry == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	if (copy_from_user(&entry->range, orient,
+				sizeof(struct orientation_range)) != 0) {
+		kmem_cache_free(lock_entry_cachep, entry);
+		return ERR_PTR(-EFAULT);
 	}
-	return flag;
-}
+	set_range_bounds(&entry->ow.bounds, &entry->range);
 
-static int no_writer_grabbed(struct orientation_range *target)
-{	
-	int rc;
-	spin_lock(&GRANTED_LOCK);
-	rc = generic_search_list(target, &granted_list, 1);
-	spin_unlock(&GRANTED_LOCK);
-	return rc;
+	entry->pid = current->pid;
+	atomic_set(&entry->granted, 0);
+	init_waitqueue_head(&entry->wait);
+	INIT_LIST_HEAD(&entry->list);
+	INIT_LIST_HEAD(&entry->granted_list);
+	INIT_LIST_HEAD(&entry->batch);
+	entry->batch_head = 0;
+	INIT_LIST_HEAD(&entry->task_list);
+	INIT_LIST_HEAD(&entry->match);
+	INIT_LIST_HEAD(&entry->starved);
+	entry->ow.bypassed = 0;
+	entry->ow.overtaken = 0;
+	entry->ow.type = type;
+	entry->file = NULL;
+	entry->owner = NULL;
+	entry->shard = NULL;
+	return entry;
 }
 
-static int no_reader_grabbed(struct orientation_range *target)
+static void free_lock_entry(struct lock_entry *entry)
 {
-	int rc;
-	spin_lock(&GRANTED_LOCK);
-	rc = generic_search_list(target, &granted_list, 0);
-	spin_unlock(&GRANTED_LOCK);
-	return rc;
+	kmem_cache_free(lock_entry_cachep, entry);
 }
 
-static void grant_lock(struct lock_entry *entry)
+static struct granted_bucket *granted_bucket(struct orientation_range *range)
 {
-	atomic_set(&entry->granted,1);
+	u32 hash = jhash2((u32 *) range,
+			  sizeof(struct orientation_range) / sizeof(u32), 0);
+	return &granted_table[hash & (GRANTED_HASH_SIZE - 1)];
+}
 
-	spin_lock(&GRANTED_LOCK);
-	list_add_tail(&entry->granted_list, &granted_list);
-	spin_unlock(&GRANTED_LOCK);
+/* NOTICE caller must hold bucket->lock */
+static struct granted_range *
+find_granted_range(struct granted_bucket *bucket,
+		   struct orientation_range *range)
+{
+	struct granted_range *grange;
+	struct hlist_node *pos;
 
-	if (&entry->list == NULL) {
-		printk("OOPS: &entry->list is NULLLLLLL ");
+	hlist_for_each_entry(grange, pos, &bucket->head, hash) {
+		if (range_equals(&grange->range, range))
+			return grange;
 	}
+	return NULL;
+}
+
+/*
+ * Points the request at the granted_range for its range, taking a
+ * reference and creating the range if this is the first lock on it.
+ * Requests not owned by an fd are also tracked on the task, so that
+ * exit_orientation_locks() can release them.
+ * Returns 0 on success or -ENOMEM.
+ */
+static int attach_granted_range(struct lock_entry *entry)
+{
+	struct orientation_range *range = &entry->range;
+	struct granted_bucket *bucket = granted_bucket(range);
+	struct granted_range *grange, *new = NULL;
 
-	if (entry->list.next == NULL) {
-		printk("Next entry is NULLL\n");
+	spin_lock(&bucket->lock);
+	grange = find_granted_range(bucket, range);
+	if (grange == NULL) {
+		/* First request on the range: allocate unlocked, recheck */
+		spin_unlock(&bucket->lock);
+		new = kmalloc(sizeof(struct granted_range), GFP_KERNEL);
+		if (new == NULL)
+			return -ENOMEM;
+		spin_lock(&bucket->lock);
+		grange = find_granted_range(bucket, range);
 	}
+	if (grange == NULL) {
+		grange = new;
+		new = NULL;
+		grange->bucket = bucket;
+		grange->range = *range;
+		grange->bounds = entry->ow.bounds;
+		INIT_LIST_HEAD(&grange->holders);
+		atomic_set(&grange->readers, 0);
+		grange->writer = 0;
+		grange->refs = 0;
+		grange->requests = 0;
+		grange->grants = 0;
+		hlist_add_head(&grange->hash, &bucket->head);
+	}
+	grange->refs++;
+	grange->requests++;
+	entry->grange = grange;
+	spin_unlock(&bucket->lock);
 
-	if(entry->list.prev == NULL) {
-		printk("Preve entry is NULL");
+	if (entry->file == NULL) {
+		entry->owner = current;
+		spin_lock(&current->orient_locks_lock);
+		list_add_tail(&entry->task_list, &current->orient_locks);
+		spin_unlock(&current->orient_locks_lock);
 	}
 
-	list_del(&entry->list);
-	wake_up(&sleepers);
+	kfree(new);
+	return 0;
 }
 
+/* NOTICE caller must hold grange->bucket->lock */
+static void put_granted_range(struct granted_range *grange)
+{
+	if (--grange->refs)
+		return;
+	hlist_del(&grange->hash);
+	kfree(grange);
+}
 
 /*
- * Returns the adjusted value of the orientation number so that
- * it falls within the given range. i.e. if out of range
- * use the min/max values.
+ * Undoes attach_granted_range(). Another task's writer unlock can
+ * get here too, so the owner's list is changed under its lock.
  */
-static int adjust_orientation(int num, int min_val, int max_val)
+static void detach_granted_range(struct lock_entry *entry)
 {
-	int range = abs((max_val - min_val));
-	if(num > max_val) {
-		return max_val;
-	} else if (num < min_val) {
-		return min_val;
-	} else { /* number is in range */
-		return num;
+	struct granted_bucket *bucket = entry->grange->bucket;
+	struct task_struct *owner = entry->owner;
+
+	if (owner != NULL) {
+		spin_lock(&owner->orient_locks_lock);
+		list_del_init(&entry->task_list);
+		spin_unlock(&owner->orient_locks_lock);
+	} else {
+		list_del_init(&entry->task_list);
 	}
+	spin_lock(&bucket->lock);
+	put_granted_range(entry->grange);
+	spin_unlock(&bucket->lock);
 }
 
-static int in_range(struct orientation_range *range,
-		struct dev_orientation orient)
+static int granted_subtree_max_hi(struct rb_node *node)
 {
-	struct dev_orientation basis = range->orient;
+	if (node)
+		return rb_entry(node, struct granted_range,
+				node)->subtree_max_hi;
+	return INT_MIN;
+}
 
-	const int pitch_range = MAX_PITCH;
-	const int roll_range = MAX_ROLL;
+/* Update 'subtree_max_hi' for a node, based on node and its children */
+static void granted_tree_augment_cb(struct rb_node *node, void *unused)
+{
+	struct granted_range *grange;
+	int max_hi, child_max_hi;
 
-	int basis_azimuth = basis.azimuth;
-	int basis_pitch = basis.pitch;
-	int basis_roll = basis.roll;
+	if (!node)
+		return;
 
-	int range_azimuth = (int) range->azimuth_range;
-	int range_pitch = (int) range->pitch_range;
-	int range_roll = (int) range->roll_range;
+	grange = rb_entry(node, struct granted_range, node);
+	max_hi = grange->bounds.azimuth_lo + grange->bounds.azimuth_span;
 
-	if(orient.azimuth > basis_azimuth + range_azimuth
-			&& range_azimuth != 0) {
-		return 0;
-	}
-	if(orient.azimuth < basis_azimuth - range_azimuth
-				&& range_azimuth != 0) {
-		return 0;
-	}
-	if((orient.pitch > basis_pitch + range_pitch ||
-			orient.pitch < basis_pitch - range_pitch)
-			&& range_pitch != 0) {
-		return 0;
-	}
-	if((orient.roll > basis_roll + range_roll ||
-	   orient.roll < basis_roll - range_roll)
-	   && range_roll != 0) {
-		return 0;
+	child_max_hi = granted_subtree_max_hi(node->rb_right);
+	if (child_max_hi > max_hi)
+		max_hi = child_max_hi;
+
+	child_max_hi = granted_subtree_max_hi(node->rb_left);
+	if (child_max_hi > max_hi)
+		max_hi = child_max_hi;
+
+	grange->subtree_max_hi = max_hi;
+}
+
+/* NOTICE caller must hold GRANTED_LOCK */
+static void granted_tree_insert(struct granted_range *grange)
+{
+	struct rb_node **link = &granted_tree.rb_node;
+	struct rb_node *parent = NULL;
+	int lo = grange->bounds.azimuth_lo;
+
+	grange->subtree_max_hi = lo + grange->bounds.azimuth_span;
+
+	while (*link) {
+		struct granted_range *this = rb_entry(*link,
+						struct granted_range, node);
+		parent = *link;
+		if (lo <= this->bounds.azimuth_lo)
+			link = &(*link)->rb_left;
+		else
+			link = &(*link)->rb_right;
 	}
 
-	return 1;
+	rb_link_node(&grange->node, parent, link);
+	rb_insert_color(&grange->node, &granted_tree);
+	rb_augment_insert(&grange->node, granted_tree_augment_cb, NULL);
 }
 
+/* NOTICE caller must hold GRANTED_LOCK */
+static void granted_tree_erase(struct granted_range *grange)
+{
+	struct rb_node *deepest;
+
+	deepest = rb_augment_erase_begin(&grange->node);
+	rb_erase(&grange->node, &granted_tree);
+	rb_augment_erase_end(deepest, granted_tree_augment_cb, NULL);
+}
 
-/* *
- * Determines if the task with given pid is still running.
- * Returns 1 if true and 0 if false.
- * Tested this on emulator to confirm it's working.
+/*
+ * Returns 1 if a held range whose azimuth interval meets [lo, hi]
+ * overlaps bounds and holds a writer, or holds anything at all when
+ * the request is a writer. Pruned the same way as waiters_tree_stab().
+ * NOTICE caller must hold GRANTED_LOCK
  */
-static int is_running(int pid ){
+static int granted_tree_conflict(struct rb_node *node, int lo, int hi,
+				 struct orientation_bounds *bounds, int writer)
+{
+	while (node) {
+		struct granted_range *grange = rb_entry(node,
+						struct granted_range, node);
 
-	struct pid *pid_struct;
-	struct task_struct *task;
-	int is_dead, is_wakekill, exit_zombie, exit_dead;
-	pid_struct = find_get_pid(pid);
+		if (grange->subtree_max_hi < lo)
+			return 0;
 
-	if(pid_struct == NULL) {
-		return 0;
-	}
-	task = pid_task(pid_struct,PIDTYPE_PID);
-	if(task == NULL) {
-		return 0;
-	}
+		if (granted_tree_conflict(node->rb_left, lo, hi, bounds,
+					  writer))
+			return 1;
 
-	is_dead = (task->state & TASK_DEAD) != 0;
-	is_wakekill = (task->state & TASK_WAKEKILL) != 0;
-	exit_zombie = (task->exit_state & EXIT_ZOMBIE) != 0;
-	exit_dead = (task->exit_state & EXIT_DEAD) != 0;
+		if (grange->bounds.azimuth_lo > hi)
+			return 0;
 
-	if(is_dead || is_wakekill || exit_zombie || exit_dead) {
-		printk("Task is not RUNNING ever: %d", task->pid);
-		return 0;
-	} else {
-		printk("Task is normal: %d ", task->pid);
-		return 1;
+		if ((grange->writer || writer) &&
+		    bounds_overlap(&grange->bounds, bounds))
+			return 1;
+
+		node = node->rb_right;
 	}
+	return 0;
 }
 
-/**
- * Removes the locks for process that are no longer running
- * from the granted list.
- * NOTICE we acquire the GRANT LIST LOCK
+/*
+ * Drops a granted lock from its range and frees it. Only the last
+ * lock on a range takes GRANTED_LOCK, to take the range out of
+ * granted_tree.
+ * A grant pass may still be publishing the grant when another task
+ * unlocks it, so for a queued request the shard lock, which the pass
+ * holds throughout, is taken before freeing. A trylock publishes
+ * under GRANTED_LOCK, which a writer's release takes; readers are
+ * only released by their own task.
+ * NOTICE caller must not hold GRANTED_LOCK, a bucket or shard lock
  */
-static void release_dead_tasks_locks(void) {
-	struct list_head *current_item;
-	struct list_head *next_item;
-	int counter = 1;
-	spin_lock(&GRANTED_LOCK);
-	list_for_each_safe(current_item, next_item, &granted_list) {
-		struct lock_entry *entry = list_entry(current_item,
-						      struct lock_entry,
-						      granted_list);
-		int pid = entry->pid;
-		if(!is_running(pid)) {
-			list_del(current_item);
+static void release_lock(struct lock_entry *entry)
+{
+	struct granted_range *grange = entry->grange;
+
+	trace_orientlock_release(entry);
+	orient_stat_inc(releases);
+	orient_stat_time(hold_hist, entry->granted_at);
+
+	spin_lock(&grange->bucket->lock);
+	list_del_init(&entry->granted_list);
+	spin_unlock(&grange->bucket->lock);
+
+	if (entry->ow.type == READER_ENTRY) {
+		if (atomic_dec_and_lock(&grange->readers, &GRANTED_LOCK)) {
+			if (!grange->writer)
+				granted_tree_erase(grange);
+			spin_unlock(&GRANTED_LOCK);
 		}
-		++counter;
+	} else {
+		spin_lock(&GRANTED_LOCK);
+		grange->writer = 0;
+		if (!atomic_read(&grange->readers))
+			granted_tree_erase(grange);
+		spin_unlock(&GRANTED_LOCK);
 	}
-	spin_unlock(&GRANTED_LOCK);
+	if (entry->shard != NULL) {
+		spin_lock(&entry->shard->lock);
+		spin_unlock(&entry->shard->lock);
+	}
+	detach_granted_range(entry);
+	kick_grant_pass();
+	free_lock_entry(entry);
+}
+
+static int get_subtree_max_hi(struct rb_node *node)
+{
+	if (node)
+		return rb_entry(node, struct lock_entry, node)->subtree_max_hi;
+	return INT_MIN;
 }
 
-static void process_waiter(struct list_head *current_item)
+/* Update 'subtree_max_hi' for a node, based on node and its children */
+static void waiters_tree_augment_cb(struct rb_node *node, void *unused)
 {
-	struct lock_entry *entry = list_entry(current_item,
-					      struct lock_entry, list);
+	struct lock_entry *entry;
+	int max_hi, child_max_hi;
 
-	struct orientation_range *target = entry->range;
+	if (!node)
+		return;
 
-	if (in_range(entry->range, current_orient)) {
-		if (entry->type == READER_ENTRY) { /* Reader */
-			if (no_writer_grabbed(target))
-				grant_lock(entry);
-		}
-		else { /* Writer */
-			if (no_writer_grabbed(target) &&
-			    no_reader_grabbed(target))
-				grant_lock(entry);
-		}
+	entry = rb_entry(node, struct lock_entry, node);
+	max_hi = entry->ow.bounds.azimuth_lo +
+		entry->ow.bounds.azimuth_span;
+
+	child_max_hi = get_subtree_max_hi(node->rb_right);
+	if (child_max_hi > max_hi)
+		max_hi = child_max_hi;
+
+	child_max_hi = get_subtree_max_hi(node->rb_left);
+	if (child_max_hi > max_hi)
+		max_hi = child_max_hi;
+
+	entry->subtree_max_hi = max_hi;
+}
+
+/* NOTICE caller must hold entry->shard->lock */
+static void waiters_tree_insert(struct lock_entry *entry)
+{
+	struct rb_node **link = &entry->shard->tree.rb_node;
+	struct rb_node *parent = NULL;
+	int lo = entry->ow.bounds.azimuth_lo;
+
+	entry->subtree_max_hi = lo + entry->ow.bounds.azimuth_span;
+
+	while (*link) {
+		struct lock_entry *this = rb_entry(*link, struct lock_entry,
+						   node);
+		parent = *link;
+		if (lo <= this->ow.bounds.azimuth_lo)
+			link = &(*link)->rb_left;
+		else
+			link = &(*link)->rb_right;
 	}
+
+	rb_link_node(&entry->node, parent, link);
+	rb_insert_color(&entry->node, &entry->shard->tree);
+	rb_augment_insert(&entry->node, waiters_tree_augment_cb, NULL);
 }
 
-SYSCALL_DEFINE1(set_orientation, struct dev_orientation __user *, orient)
+/* NOTICE caller must hold entry->shard->lock */
+static void waiters_tree_erase(struct lock_entry *entry)
 {
-	spin_lock(&SET_LOCK);
-	struct list_head *current_item, *next_item;
-	int counter;
+	struct rb_node *deepest;
 
-	counter = 0;
-	if (copy_from_user(&current_orient, orient,
-				sizeof(struct dev_orientation)) != 0)
-		return -EFAULT;
+	deepest = rb_augment_erase_begin(&entry->node);
+	rb_erase(&entry->node, &entry->shard->tree);
+	rb_augment_erase_end(deepest, waiters_tree_augment_cb, NULL);
+}
+
+/*
+ * Collects every waiter whose range contains orient, and whose
+ * azimuth interval contains key, onto matches. Subtrees whose
+ * largest high end is below key are pruned, as are right subtrees
+ * once the low end passes key.
+ */
+static void waiters_tree_stab(struct rb_node *node, int key,
+			      struct dev_orientation *orient,
+			      struct list_head *matches, int *scanned)
+{
+	while (node) {
+		struct lock_entry *entry = rb_entry(node, struct lock_entry,
+						    node);
+		int lo = entry->ow.bounds.azimuth_lo;
+
+		(*scanned)++;
+		if (entry->subtree_max_hi < key)
+			return;
+
+		waiters_tree_stab(node->rb_left, key, orient, matches,
+				  scanned);
 
-	spin_lock(&WAITERS_LOCK);
-	release_dead_tasks_locks();
+		if (lo > key)
+			return;
 
-	list_for_each_safe(current_item, next_item, &waiters_list) {
-		process_waiter(current_item);
+		if (key <= lo + (int) entry->ow.bounds.azimuth_span &&
+		    in_bounds(&entry->ow.bounds, orient))
+			list_add_tail(&entry->match, matches);
+
+		node = node->rb_right;
 	}
+}
 
-	spin_unlock(&WAITERS_LOCK);
-	spin_unlock(&SET_LOCK);
-	return 0;
+/* Edge values of entry, see bounds_edge() */
+static int entry_edge(struct lock_entry *entry, int edge, int *value)
+{
+	return bounds_edge(&entry->ow.bounds, edge, value);
 }
 
-// TODO: Fix the list traversal in all SYS calls : use list_for_each_safe.
-SYSCALL_DEFINE1(orientlock_read, struct orientation_range __user *, orient)
+/* NOTICE caller must hold entry->shard->lock */
+static void edges_insert(struct lock_entry *entry)
 {
-	struct orientation_range *korient;
-	struct lock_entry *entry;
-	DEFINE_WAIT(wait);
-	
-	korient = kmalloc(sizeof(struct orientation_range), GFP_KERNEL);
+	int edge;
 
-	if (korient == NULL) {
-		printk("Kmalloc failure: orientlock_read");
-		return  -ENOMEM;
-	}
+	for (edge = 0; edge < 2 * ORIENT_AXES; edge++) {
+		struct orient_edge *this = &entry->edges[edge];
+		struct rb_root *root = &entry->shard->edges[edge / 2];
+		struct rb_node **link = &root->rb_node;
+		struct rb_node *parent = NULL;
 
-	if (copy_from_user(korient, orient,
-				sizeof(struct orientation_range)) != 0)
-		return -EFAULT;
+		if (!entry_edge(entry, edge, &this->value)) {
+			RB_CLEAR_NODE(&this->node);
+			continue;
+		}
 
-	entry = kmalloc(sizeof(struct lock_entry), GFP_KERNEL);
+		while (*link) {
+			parent = *link;
+			if (this->value <= rb_entry(parent, struct orient_edge,
+						    node)->value)
+				link = &(*link)->rb_left;
+			else
+				link = &(*link)->rb_right;
+		}
+		rb_link_node(&this->node, parent, link);
+		rb_insert_color(&this->node, root);
+	}
+}
 
-	if (entry == NULL) {
-		printk("\nKmalloc failure: orientlock_read");
-		return -ENOMEM;
+/* NOTICE caller must hold entry->shard->lock */
+static void edges_erase(struct lock_entry *entry)
+{
+	int edge;
+
+	for (edge = 0; edge < 2 * ORIENT_AXES; edge++) {
+		if (!RB_EMPTY_NODE(&entry->edges[edge].node))
+			rb_erase(&entry->edges[edge].node,
+				 &entry->shard->edges[edge / 2]);
 	}
+}
 
-	entry->range = korient;
-	entry->pid = current->pid;
-	atomic_set(&entry->granted,0);
-	INIT_LIST_HEAD(&entry->list);
-	INIT_LIST_HEAD(&entry->granted_list);
-	entry->type = READER_ENTRY;
+/*
+ * Looks up the edges of an axis around value: *below is raised to
+ * the largest edge <= value and *above lowered to the smallest edge
+ * > value, so the results of several shards can be combined.
+ * NOTICE caller must hold the shard lock owning root
+ */
+static void edges_around(struct rb_root *root, int value, int *below,
+			 int *above)
+{
+	struct rb_node *node = root->rb_node;
 
-	spin_lock(&WAITERS_LOCK);
-	list_add_tail(&entry->list, &waiters_list);
-	spin_unlock(&WAITERS_LOCK);
+	while (node) {
+		int edge = rb_entry(node, struct orient_edge, node)->value;
 
-	add_wait_queue(&sleepers, &wait);
-	while(!atomic_read(&entry->granted)) {
-	       prepare_to_wait(&sleepers, &wait, TASK_INTERRUPTIBLE);
-	       schedule();
+		if (edge <= value) {
+			if (edge > *below)
+				*below = edge;
+			node = node->rb_right;
+		} else {
+			if (edge < *above)
+				*above = edge;
+			node = node->rb_left;
+		}
 	}
-	finish_wait(&sleepers, &wait);
+}
 
-	return 0;
+/* Takes every shard lock, in index order, for a grant pass */
+static void lock_waiter_shards(void)
+{
+	int i;
+
+	for (i = 0; i < WAITER_SHARDS; i++)
+		spin_lock_nested(&waiter_shards[i].lock, i);
 }
 
-SYSCALL_DEFINE1(orientlock_write, struct orientation_range __user *, orient)
+static void unlock_waiter_shards(void)
 {
-	struct orientation_range *korient;
-	struct lock_entry *entry;
-	DEFINE_WAIT(wait);
+	int i;
 
-	korient = kmalloc(sizeof(struct orientation_range), GFP_KERNEL);
+	for (i = WAITER_SHARDS - 1; i >= 0; i--)
+		spin_unlock(&waiter_shards[i].lock);
+}
 
-	if (korient == NULL) {
-		printk("Kmalloc failure: orientlock_write\n");
-		return  -ENOMEM;
-	}
-	if (copy_from_user(korient, orient,
-				sizeof(struct orientation_range)) != 0)
-		return -EFAULT;
+/* Reads the deadband sysctl, clamped to half a turn per axis */
+static void read_deadband(int *deadband)
+{
+	int axis;
 
-	entry = kmalloc(sizeof(entry), GFP_KERNEL);
+	for (axis = 0; axis < ORIENT_AXES; axis++)
+		deadband[axis] = clamp(ACCESS_ONCE(
+			sysctl_orientlock_deadband[axis]), 0, ORIENT_TURN / 2);
+}
 
-	if (entry == NULL) {
-		printk("Kmalloc failure!...\n");
-		return -ENOMEM;
-	}
-	
-	entry->range = korient;
-	entry->pid = current->pid;
-	atomic_set(&entry->granted, 0);
-	INIT_LIST_HEAD(&entry->list);
-	INIT_LIST_HEAD(&entry->granted_list);
-	entry->type = WRITER_ENTRY;
+/*
+ * Orders grant pass matches for the policy priv points to: readers
+ * or writers first if it prefers one, then by arrival.
+ */
+static int waiter_policy_cmp(void *priv, struct list_head *a,
+			     struct list_head *b)
+{
+	struct lock_entry *one = list_entry(a, struct lock_entry, match);
+	struct lock_entry *two = list_entry(b, struct lock_entry, match);
 
-	spin_lock(&WAITERS_LOCK);
-	list_add_tail(&entry->list, &waiters_list);
-	spin_unlock(&WAITERS_LOCK);
+	return policy_cmp(*(int *) priv, &one->ow, &two->ow);
+}
 
-	add_wait_queue(&sleepers, &wait);
-	while(!atomic_read(&entry->granted)) {
-		prepare_to_wait(&sleepers, &wait, TASK_INTERRUPTIBLE);
-		schedule();
+/*
+ * Queues new lock requests on the shard of the current CPU. All of
+ * them are queued under a single hold of its lock, so a grant pass
+ * never sees part of a batch, and a whole batch shares one shard.
+ * Returns 0 on success or -ENOMEM.
+ */
+static int enqueue_waiters(struct lock_entry **entries, int count)
+{
+	struct waiter_shard *shard;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (attach_granted_range(entries[i]) != 0)
+			goto out_put;
+	}
+
+	shard = &waiter_shards[raw_smp_processor_id() % WAITER_SHARDS];
+	spin_lock(&shard->lock);
+	/* Counted before any gets a seq, see nr_queued_waiters() */
+	atomic_add(count, &shard->nr_waiters);
+	atomic_set(&demand_changed, 1);
+	for (i = 0; i < count; i++) {
+		entries[i]->shard = shard;
+		entries[i]->queued_at = local_clock();
+		entries[i]->ow.seq = atomic_long_inc_return(&waiters_seq);
+		list_add_tail(&entries[i]->list, &shard->list);
+		waiters_tree_insert(entries[i]);
+		edges_insert(entries[i]);
+		trace_orientlock_enqueue(entries[i]);
 	}
-	finish_wait(&sleepers, &wait);
+	spin_unlock(&shard->lock);
+	kick_grant_pass();
+	orient_stat_add(waits, count);
 	return 0;
+
+out_put:
+	while (--i >= 0)
+		detach_granted_range(entries[i]);
+	return -ENOMEM;
 }
 
-SYSCALL_DEFINE1(orientunlock_read, struct orientation_range __user *, orient)
+/* NOTICE caller must hold entry->shard->lock */
+static void dequeue_waiter(struct lock_entry *entry)
 {
-	struct orientation_range korient;
-	struct list_head *current_item, *next_item;
-	struct lock_entry *entry = NULL;
-	int did_unlock = 0;
-	if (copy_from_user(&korient, orient,
-				sizeof(struct orientation_range)) != 0)
-		return -EFAULT;
-	
-	spin_lock(&GRANTED_LOCK);
-	list_for_each_safe(current_item, next_item, &granted_list) {
-		entry = list_entry(current_item,
-				   struct lock_entry, granted_list);
-		if (range_equals(&korient, entry->range) &&
-		    entry->type == READER_ENTRY) {
-			/* Unlock is to be done original locking pid process */
-			int curr_pid = current->pid;
-			/* DO NOT RETURN eearly, process the entire list */
-			if (curr_pid != entry->pid)
-				continue;
+	list_del(&entry->list);
+	list_del_init(&entry->match);
+	list_del_init(&entry->starved);
+	waiters_tree_erase(entry);
+	edges_erase(entry);
+	atomic_dec(&entry->shard->nr_waiters);
+	atomic_set(&demand_changed, 1);
+}
 
-			list_del(current_item);
-			kfree(entry->range);
-			kfree(entry);
-			spin_unlock(&GRANTED_LOCK);
-			did_unlock = 1;
-			break;
-		}
-		else
-			; //no locks with the orientation_range available
-	}
+/*
+ * Returns the number of queued requests, without taking any lock.
+ * A request is counted before its seq is taken, so a caller that
+ * took a seq itself beforehand sees every older request counted.
+ */
+static int nr_queued_waiters(void)
+{
+	int i, nr = 0;
 
+	for (i = 0; i < WAITER_SHARDS; i++)
+		nr += atomic_read(&waiter_shards[i].nr_waiters);
+	return nr;
+}
 
-	if (!did_unlock) { /* failed to unlocked */
-		spin_unlock(&GRANTED_LOCK);
-		return -1;
-	} else {
-		return 0;
-	}
+/*
+ * Counts the request against its range in granted_tree, so later
+ * requests see the conflict. Nobody else can see the grant until
+ * publish_grant().
+ * NOTICE caller must hold GRANTED_LOCK
+ */
+static void hold_lock(struct lock_entry *entry)
+{
+	struct granted_range *grange = entry->grange;
+
+	entry->granted_at = local_clock();
+
+	if (!atomic_read(&grange->readers) && !grange->writer)
+		granted_tree_insert(grange);
+	if (entry->ow.type == READER_ENTRY)
+		atomic_inc(&grange->readers);
+	else
+		grange->writer = 1;
 }
 
-SYSCALL_DEFINE1(orientunlock_write, struct orientation_range __user *, orient)
+/*
+ * Makes a grant visible: lists the request on its range's holders,
+ * where an unlock can find it, marks it granted and wakes its owner.
+ * From then on the request may be released at any moment, so this
+ * must be the last thing done with it.
+ * NOTICE caller must hold GRANTED_LOCK
+ */
+static void publish_grant(struct lock_entry *entry)
 {
-	struct orientation_range korient;
-	struct list_head *current_item, *next_item;
+	struct granted_range *grange = entry->grange;
 
-	if (copy_from_user(&korient, orient,
-				sizeof(struct orientation_range)) != 0)
-		return -EFAULT;
-	
-	spin_lock(&GRANTED_LOCK);
-	list_for_each_safe(current_item, next_item, &granted_list) {
-		struct lock_entry *entry;
-		entry = list_entry(current_item,
-				   struct lock_entry, granted_list);
-		if (range_equals(&korient, entry->range) &&
-		    entry->type == WRITER_ENTRY) {
-			list_del(current_item);
-			kfree(entry->range);
-			kfree(entry);
-			spin_unlock(&GRANTED_LOCK);
-			return 0;
-		}	
-		else
-			; //no locks with the orientation_range available
+	trace_orientlock_grant(entry);
+	orient_stat_inc(grants);
+	spin_lock(&grange->bucket->lock);
+	list_add_tail(&entry->granted_list, &grange->holders);
+	grange->grants++;
+	spin_unlock(&grange->bucket->lock);
+	atomic_set(&entry->granted, 1);
+	wake_up(&entry->wait);
+}
+
+/*
+ * Takes a waiter off the queue as a holder; publish_grant() then
+ * hands it over.
+ * NOTICE caller must hold every shard lock and GRANTED_LOCK
+ */
+static void grant_lock(struct lock_entry *entry)
+{
+	hold_lock(entry);
+	orient_stat_time(wait_hist, entry->queued_at);
+	dequeue_waiter(entry);
+}
+
+/*
+ * Sleeps until publish_grant() hands the lock to this request. Each
+ * request has its own wait queue, so a grant wakes only its owner.
+ * Only a fatal signal ends the wait early, returning -EINTR.
+ */
+static int wait_for_grant(struct lock_entry *entry)
+{
+	DEFINE_WAIT(wait);
+	int rc = 0;
+
+	for (;;) {
+		prepare_to_wait(&entry->wait, &wait, TASK_KILLABLE);
+		if (atomic_read(&entry->granted))
+			break;
+		if (fatal_signal_pending(current)) {
+			rc = -EINTR;
+			break;
+		}
+		schedule();
+	}
+	finish_wait(&entry->wait, &wait);
+	if (rc == 0)
+		trace_orientlock_wakeup(entry);
+	return rc;
+}
+
+/*
+ * Like wait_for_grant() but gives up after timeout jiffies or when
+ * a signal is pending. Returns 0 if granted, -ETIMEDOUT or -EINTR.
+ */
+static int wait_for_grant_timeout(struct lock_entry *entry, long timeout)
+{
+	DEFINE_WAIT(wait);
+	int rc = 0;
+
+	for (;;) {
+		prepare_to_wait(&entry->wait, &wait, TASK_INTERRUPTIBLE);
+		if (atomic_read(&entry->granted))
+			break;
+		if (signal_pending(current)) {
+			rc = -EINTR;
+			break;
+		}
+		if (!timeout) {
+			rc = -ETIMEDOUT;
+			break;
+		}
+		timeout = schedule_timeout(timeout);
+	}
+	finish_wait(&entry->wait, &wait);
+	if (rc == 0)
+		trace_orientlock_wakeup(entry);
+	return rc;
+}
+
+/*
+ * Removes a queued request and frees it.
+ * NOTICE caller must hold entry->shard->lock
+ */
+static void withdraw_waiter(struct lock_entry *entry)
+{
+	trace_orientlock_cancel(entry);
+	dequeue_waiter(entry);
+	atomic_set(&waiters_changed, 1);
+	detach_granted_range(entry);
+	free_lock_entry(entry);
+}
+
+/*
+ * Withdraws a request, along with the rest of its batch, that
+ * stopped waiting. Grants happen under every shard lock, so holding
+ * the request's own shard lock, it is either still queued here or
+ * was granted just before we got the lock.
+ * Returns 0 if it had been granted after all, 1 if withdrawn.
+ */
+static int cancel_waiter(struct lock_entry *entry)
+{
+	struct waiter_shard *shard = entry->shard;
+	struct lock_entry *member, *next;
+
+	spin_lock(&shard->lock);
+	if (atomic_read(&entry->granted)) {
+		spin_unlock(&shard->lock);
+		return 0;
+	}
+
+	list_for_each_entry_safe(member, next, &entry->batch, batch)
+		withdraw_waiter(member);
+	withdraw_waiter(entry);
+	spin_unlock(&shard->lock);
+	return 1;
+}
+
+
+/*
+ * Returns 1 if a held lock conflicts with the request. A reader
+ * conflicts with a writer on any overlapping range, a writer with
+ * any lock on an overlapping range. Held intervals lie within
+ * [0, 2 * ORIENT_TURN), so the request's interval is also searched
+ * one turn either side to catch overlaps across north.
+ * NOTICE caller must hold GRANTED_LOCK
+ */
+static int holders_conflict(struct lock_entry *entry)
+{
+	struct orientation_bounds *bounds = &entry->ow.bounds;
+	int lo = bounds->azimuth_lo;
+	int hi = lo + bounds->azimuth_span;
+	int writer = entry->ow.type == WRITER_ENTRY;
+	int turn;
+
+	for (turn = -ORIENT_TURN; turn <= ORIENT_TURN; turn += ORIENT_TURN) {
+		if (granted_tree_conflict(granted_tree.rb_node, lo + turn,
+					  hi + turn, bounds, writer))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * A grant pass over the waiter shards, driven by the core through
+ * grant_pass_ops: matches holds the in-range waiters not considered
+ * yet, in policy order, passed the ones considered and not granted.
+ * Every callback expects every shard lock held, and those that grant
+ * GRANTED_LOCK as well.
+ */
+struct grant_pass {
+	struct list_head matches;
+	struct list_head passed;
+	int matched; /* waiters considered */
+};
+
+static struct lock_entry *waiter_entry(struct orient_waiter *w)
+{
+	return container_of(w, struct lock_entry, ow);
+}
+
+static struct orient_waiter *pass_next_match(void *data)
+{
+	struct grant_pass *pass = data;
+	struct lock_entry *entry;
+
+	if (list_empty(&pass->matches))
+		return NULL;
+	entry = list_first_entry(&pass->matches, struct lock_entry, match);
+	list_move_tail(&entry->match, &pass->passed);
+	pass->matched++;
+	return &entry->ow;
+}
+
+/* Walks matches, then passed; granted waiters have left both */
+static struct orient_waiter *pass_next_pending(void *data,
+					       struct orient_waiter *prev)
+{
+	struct grant_pass *pass = data;
+	struct list_head *pos;
+
+	pos = prev ? waiter_entry(prev)->match.next : pass->matches.next;
+	if (pos == &pass->matches)
+		pos = pass->passed.next;
+	if (pos == &pass->passed)
+		return NULL;
+	return &list_entry(pos, struct lock_entry, match)->ow;
+}
+
+/* Walks the starved lists of every shard; needs no pass */
+static struct orient_waiter *pass_next_starved(void *data,
+					       struct orient_waiter *prev)
+{
+	struct list_head *pos;
+	int i = 0;
+
+	if (prev != NULL) {
+		struct lock_entry *entry = waiter_entry(prev);
+
+		i = entry->shard - waiter_shards;
+		pos = entry->starved.next;
+	} else {
+		pos = waiter_shards[0].starved.next;
+	}
+	while (pos == &waiter_shards[i].starved) {
+		if (++i == WAITER_SHARDS)
+			return NULL;
+		pos = waiter_shards[i].starved.next;
 	}
+	return &list_entry(pos, struct lock_entry, starved)->ow;
+}
+
+/* The head of a batch links the other members on its batch ring */
+static struct orient_waiter *pass_next_member(void *data,
+					      struct orient_waiter *w,
+					      struct orient_waiter *prev)
+{
+	struct lock_entry *head = waiter_entry(w);
+	struct list_head *pos;
+
+	pos = prev ? waiter_entry(prev)->batch.next : head->batch.next;
+	if (pos == &head->batch)
+		return NULL;
+	return &list_entry(pos, struct lock_entry, batch)->ow;
+}
+
+static int pass_holders_conflict(void *data, struct orient_waiter *w)
+{
+	return holders_conflict(waiter_entry(w));
+}
+
+static void pass_grant(void *data, struct orient_waiter *w)
+{
+	grant_lock(waiter_entry(w));
+}
+
+/*
+ * Publishes a granted batch. The pass may reach any member of it
+ * first, so the batch head, which its owner sleeps on, is looked up
+ * and published last: once it wakes, every other member is held.
+ */
+static void pass_publish(void *data, struct orient_waiter *w)
+{
+	struct lock_entry *entry = waiter_entry(w);
+	struct lock_entry *head = entry, *member, *next;
+
+	list_for_each_entry(member, &entry->batch, batch) {
+		if (member->batch_head)
+			head = member;
+	}
+
+	list_for_each_entry_safe(member, next, &entry->batch, batch) {
+		list_del_init(&member->batch);
+		if (member != head)
+			publish_grant(member);
+	}
+	if (entry != head)
+		publish_grant(entry);
+	publish_grant(head);
+}
+
+static void pass_starve(void *data, struct orient_waiter *w)
+{
+	struct lock_entry *entry = waiter_entry(w);
+
+	if (!list_empty(&entry->starved))
+		return;
+	list_add_tail(&entry->starved, &entry->shard->starved);
+}
+
+/* Combines the edge trees of every shard */
+static void pass_edges_around(void *data, int axis, int value, int *below,
+			      int *above)
+{
+	int i;
+
+	for (i = 0; i < WAITER_SHARDS; i++)
+		edges_around(&waiter_shards[i].edges[axis], value, below,
+			     above);
+}
+
+static const struct orient_pass_ops grant_pass_ops = {
+	.next_match = pass_next_match,
+	.next_pending = pass_next_pending,
+	.next_starved = pass_next_starved,
+	.next_member = pass_next_member,
+	.holders_conflict = pass_holders_conflict,
+	.grant = pass_grant,
+	.publish = pass_publish,
+	.starve = pass_starve,
+	.edges_around = pass_edges_around,
+};
+
+/*
+ * Grant pass: hands locks to waiters that are in range of the
+ * latest published orientation. Runs on orient_wq, so updates that
+ * arrive while a pass is queued share that one pass. Afterwards it
+ * records the cell the device was in, and runs again if the device
+ * already left it.
+ */
+static void orientation_grant_pass(struct work_struct *work)
+{
+	struct dev_orientation korient;
+	struct lock_entry *entry, *next;
+	struct grant_pass pass;
+	struct orient_cell cell;
+	int deadband[ORIENT_AXES];
+	int scanned = 0;
+	int policy, moved, i;
+
+	/* This pass sees every change made so far */
+	atomic_set(&waiters_changed, 0);
+	korient = read_current_orient();
+
+	INIT_LIST_HEAD(&pass.matches);
+	INIT_LIST_HEAD(&pass.passed);
+	pass.matched = 0;
+
+	/* Combine the in-range waiters of every shard, then order them */
+	lock_waiter_shards();
+	for (i = 0; i < WAITER_SHARDS; i++) {
+		struct rb_node *root = waiter_shards[i].tree.rb_node;
+
+		waiters_tree_stab(root, korient.azimuth, &korient,
+				  &pass.matches, &scanned);
+		waiters_tree_stab(root, korient.azimuth + ORIENT_TURN,
+				  &korient, &pass.matches, &scanned);
+	}
+	policy = ACCESS_ONCE(sysctl_orientlock_policy);
+	list_sort(&policy, &pass.matches, waiter_policy_cmp);
+
+	spin_lock(&GRANTED_LOCK);
+	grant_waiters(&grant_pass_ops, &pass, &korient,
+		      ACCESS_ONCE(sysctl_orientlock_max_bypass));
 	spin_unlock(&GRANTED_LOCK);
-	printk("Undefined error\n");
+	list_for_each_entry_safe(entry, next, &pass.passed, match)
+		list_del_init(&entry->match);
+
+	compute_cell(&grant_pass_ops, &pass, &korient, &cell);
+	unlock_waiter_shards();
+
+	read_deadband(deadband);
+	spin_lock(&SET_LOCK);
+	grant_cell = cell;
+	grant_cell_valid = 1;
+	moved = !in_cell(&cell, &current_orient, deadband);
+	spin_unlock(&SET_LOCK);
+	if (moved)
+		queue_work(orient_wq, work);
+
+	orient_stat_inc(passes);
+	orient_stat_add(scanned, scanned);
+	orient_stat_add(matched, pass.matched);
+	orient_stat_inc(scan_hist[orient_hist_bucket(scanned)]);
+}
+
+/*
+ * Publishes a new orientation and, if it could change which waiters
+ * are in range, schedules a grant pass for it. Never walks the
+ * waiters itself, so the daemon does not stall; if a pass is already
+ * queued this update is coalesced into it. A stamped sample older
+ * than the last one published is dropped.
+ */
+static void publish_orientation(struct dev_orientation *korient,
+				s64 *stamp)
+{
+	int deadband[ORIENT_AXES];
+	int pass;
+
+	korient->azimuth = normalize_azimuth(korient->azimuth);
+	read_deadband(deadband);
+
+	spin_lock(&SET_LOCK);
+	if (stamp != NULL) {
+		if (*stamp < current_stamp) {
+			spin_unlock(&SET_LOCK);
+			return;
+		}
+		current_stamp = *stamp;
+	}
+	write_seqcount_begin(&orient_seq);
+	current_orient = *korient;
+	write_seqcount_end(&orient_seq);
+	pass = atomic_xchg(&waiters_changed, 0) || !grant_cell_valid ||
+		!in_cell(&grant_cell, korient, deadband);
+	spin_unlock(&SET_LOCK);
+	trace_orientation_set(korient);
+
+	if (!pass)
+		orient_stat_inc(suppressed);
+	else if (!queue_work(orient_wq, &grant_work))
+		orient_stat_inc(coalesced);
+}
+
+SYSCALL_DEFINE1(set_orientation, struct dev_orientation __user *, orient)
+{
+	struct dev_orientation korient;
+
+	if (copy_from_user(&korient, orient,
+				sizeof(struct dev_orientation)) != 0)
+		return -EFAULT;
+
+	publish_orientation(&korient, NULL);
+	orient_stat_inc(set_orientation);
+	return 0;
+}
+
+/*
+ * Takes every sample a sensor poll returned in one call. Timestamps
+ * must not go backwards within the batch. Only the newest sample is
+ * published: the grant pass always works from the latest orientation
+ * anyway, so the ones before it would only be coalesced.
+ * Returns 1 if orientlock_demand would now report something new,
+ * so orientd need not ask on every poll, else 0.
+ */
+SYSCALL_DEFINE2(set_orientation_batch,
+		struct orientation_sample __user *, samples, int, count)
+{
+	struct orientation_sample ksamples[ORIENT_SAMPLES_MAX];
+	int i;
+
+	if (count <= 0 || count > ORIENT_SAMPLES_MAX)
+		return -EINVAL;
+	if (copy_from_user(ksamples, samples,
+			   count * sizeof(struct orientation_sample)) != 0)
+		return -EFAULT;
+
+	for (i = 1; i < count; i++) {
+		if (ksamples[i].timestamp < ksamples[i - 1].timestamp)
+			return -EINVAL;
+	}
+
+	publish_orientation(&ksamples[count - 1].orient,
+			    &ksamples[count - 1].timestamp);
+	orient_stat_add(set_orientation, count);
+	return atomic_read(&demand_changed) ? 1 : 0;
+}
+
+/*
+ * Copies the current device orientation to userspace. Takes no
+ * lock, so it is cheap enough to sample as often as needed.
+ */
+SYSCALL_DEFINE1(get_orientation, struct dev_orientation __user *, orient)
+{
+	struct dev_orientation korient = read_current_orient();
+
+	if (copy_to_user(orient, &korient,
+				sizeof(struct dev_orientation)) != 0)
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Finds the narrowest +/- range waited on per axis, into
+ * demand->min_range. Axes a request accepts any value on do not
+ * count.
+ */
+static void compute_demand(struct orientlock_demand *demand)
+{
+	struct lock_entry *entry;
+	int i, axis;
+
+	for (axis = 0; axis < ORIENT_AXES; axis++)
+		demand->min_range[axis] = UINT_MAX;
+
+	for (i = 0; i < WAITER_SHARDS; i++) {
+		struct waiter_shard *shard = &waiter_shards[i];
+
+		if (!atomic_read(&shard->nr_waiters))
+			continue;
+		spin_lock(&shard->lock);
+		list_for_each_entry(entry, &shard->list, list) {
+			struct orientation_bounds *bounds = &entry->ow.bounds;
+			unsigned int span[ORIENT_AXES] = {
+				bounds->azimuth_span, bounds->pitch_span,
+				bounds->roll_span
+			};
+
+			if (span[ORIENT_AZIMUTH_AXIS] >= ORIENT_TURN - 1)
+				span[ORIENT_AZIMUTH_AXIS] = UINT_MAX;
+			for (axis = 0; axis < ORIENT_AXES; axis++) {
+				if (span[axis] != UINT_MAX &&
+				    span[axis] / 2 < demand->min_range[axis])
+					demand->min_range[axis] =
+						span[axis] / 2;
+			}
+		}
+		spin_unlock(&shard->lock);
+	}
+}
+
+/*
+ * Reports how many requests are waiting and how narrow their ranges
+ * are, so orientd can sample slowly, or barely at all, when nothing
+ * depends on a fresh orientation. The waiters are only walked again
+ * once some were queued or left the queue; set_orientation_batch
+ * tells orientd when that happened.
+ */
+SYSCALL_DEFINE1(orientlock_demand, struct orientlock_demand __user *, demand)
+{
+	struct orientlock_demand kdemand;
+
+	spin_lock(&DEMAND_LOCK);
+	if (atomic_xchg(&demand_changed, 0))
+		compute_demand(&demand_cache);
+	kdemand = demand_cache;
+	spin_unlock(&DEMAND_LOCK);
+	kdemand.waiters = nr_queued_waiters();
+
+	if (copy_to_user(demand, &kdemand,
+			 sizeof(struct orientlock_demand)) != 0)
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Queues a lock request of the given type and sleeps until it is
+ * granted.
+ */
+static int orientlock(struct orientation_range __user *orient, int type)
+{
+	struct lock_entry *entry;
+	int rc;
+
+	entry = alloc_lock_entry(orient, type);
+	if (IS_ERR(entry))
+		return PTR_ERR(entry);
+
+	rc = enqueue_waiters(&entry, 1);
+	if (rc != 0) {
+		free_lock_entry(entry);
+		return rc;
+	}
+
+	rc = wait_for_grant(entry);
+	if (rc != 0 && !cancel_waiter(entry))
+		rc = 0;
+	return rc;
+}
+
+SYSCALL_DEFINE1(orientlock_read, struct orientation_range __user *, orient)
+{
+	return orientlock(orient, READER_ENTRY);
+}
+
+SYSCALL_DEFINE1(orientlock_write, struct orientation_range __user *, orient)
+{
+	return orientlock(orient, WRITER_ENTRY);
+}
+
+/*
+ * A trylock on entry was just granted at orient, ahead of any older
+ * waiter in range: those it conflicts with were overtaken, and count
+ * a bypass as if a grant pass had granted it.
+ * NOTICE caller must hold every shard lock
+ */
+static void overtake_waiters(struct lock_entry *entry,
+			     struct dev_orientation *orient)
+{
+	struct lock_entry *waiter, *next;
+	struct grant_pass pass;
+	int scanned = 0, i;
+
+	INIT_LIST_HEAD(&pass.matches);
+	INIT_LIST_HEAD(&pass.passed);
+	pass.matched = 0;
+	for (i = 0; i < WAITER_SHARDS; i++) {
+		struct rb_node *root = waiter_shards[i].tree.rb_node;
+
+		waiters_tree_stab(root, orient->azimuth, orient,
+				  &pass.passed, &scanned);
+		waiters_tree_stab(root, orient->azimuth + ORIENT_TURN,
+				  orient, &pass.passed, &scanned);
+	}
+
+	mark_overtaken(&grant_pass_ops, &pass, &entry->ow);
+	account_bypasses(&grant_pass_ops, &pass,
+			 ACCESS_ONCE(sysctl_orientlock_max_bypass));
+	list_for_each_entry_safe(waiter, next, &pass.passed, match)
+		list_del_init(&waiter->match);
+}
+
+/*
+ * Takes the lock only if the device is in range right now and no
+ * conflicting lock is held. Never sleeps; returns -EBUSY otherwise.
+ */
+static int orientlock_try(struct orientation_range __user *orient, int type)
+{
+	struct dev_orientation korient;
+	struct lock_entry *entry;
+	int waiting, rc = -EBUSY;
+
+	entry = alloc_lock_entry(orient, type);
+	if (IS_ERR(entry))
+		return PTR_ERR(entry);
+
+	korient = read_current_orient();
+	if (!in_bounds(&entry->ow.bounds, &korient)) {
+		free_lock_entry(entry);
+		return -EBUSY;
+	}
+
+	if (attach_granted_range(entry) != 0) {
+		free_lock_entry(entry);
+		return -ENOMEM;
+	}
+
+	/*
+	 * The shard locks are only needed if there are waiters, to
+	 * respect the starved ones and count bypasses against the rest.
+	 * Every waiter older than this request is counted by now.
+	 */
+	entry->ow.seq = atomic_long_inc_return(&waiters_seq);
+	waiting = nr_queued_waiters();
+	if (waiting)
+		lock_waiter_shards();
+	spin_lock(&GRANTED_LOCK);
+	if (!holders_conflict(entry) &&
+	    !(waiting && overtakes_starved(&grant_pass_ops, NULL, &entry->ow,
+					   &korient))) {
+		hold_lock(entry);
+		if (waiting)
+			overtake_waiters(entry, &korient);
+		publish_grant(entry);
+		rc = 0;
+	}
+	spin_unlock(&GRANTED_LOCK);
+	if (waiting)
+		unlock_waiter_shards();
+
+	if (rc != 0) {
+		detach_granted_range(entry);
+		free_lock_entry(entry);
+	}
+	return rc;
+}
+
+/*
+ * Queues a lock request and sleeps for at most the relative timeout.
+ * Returns -ETIMEDOUT if it expires first and -EINTR on a signal;
+ * either way the request is withdrawn.
+ */
+static int orientlock_timed(struct orientation_range __user *orient, int type,
+			    const struct timespec __user *timeout)
+{
+	struct lock_entry *entry;
+	struct timespec ts;
+	int rc;
+
+	if (copy_from_user(&ts, timeout, sizeof(struct timespec)) != 0)
+		return -EFAULT;
+	if (!timespec_valid(&ts))
+		return -EINVAL;
+
+	entry = alloc_lock_entry(orient, type);
+	if (IS_ERR(entry))
+		return PTR_ERR(entry);
+
+	rc = enqueue_waiters(&entry, 1);
+	if (rc != 0) {
+		free_lock_entry(entry);
+		return rc;
+	}
+
+	rc = wait_for_grant_timeout(entry, timespec_to_jiffies(&ts));
+	if (rc != 0 && !cancel_waiter(entry))
+		rc = 0;
+	return rc;
+}
+
+SYSCALL_DEFINE1(orientlock_tryread, struct orientation_range __user *, orient)
+{
+	return orientlock_try(orient, READER_ENTRY);
+}
+
+SYSCALL_DEFINE1(orientlock_trywrite, struct orientation_range __user *, orient)
+{
+	return orientlock_try(orient, WRITER_ENTRY);
+}
+
+SYSCALL_DEFINE2(orientlock_timedread, struct orientation_range __user *, orient,
+		const struct timespec __user *, timeout)
+{
+	return orientlock_timed(orient, READER_ENTRY, timeout);
+}
+
+SYSCALL_DEFINE2(orientlock_timedwrite, struct orientation_range __user *, orient,
+		const struct timespec __user *, timeout)
+{
+	return orientlock_timed(orient, WRITER_ENTRY, timeout);
+}
+
+/*
+ * An orientlock fd wraps a single lock request. It polls readable
+ * once the lock is granted, so one thread can wait on many ranges
+ * with poll/epoll. Closing the fd withdraws the request or releases
+ * the lock.
+ */
+static unsigned int orientlock_fd_poll(struct file *file, poll_table *wait)
+{
+	struct lock_entry *entry = file->private_data;
+
+	poll_wait(file, &entry->wait, wait);
+	if (atomic_read(&entry->granted))
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+/* Blocks until the lock is granted, then reads back an int 1 */
+static ssize_t orientlock_fd_read(struct file *file, char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	struct lock_entry *entry = file->private_data;
+	int rc;
+
+	if (count < sizeof(int))
+		return -EINVAL;
+
+	if (!atomic_read(&entry->granted)) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		rc = wait_event_interruptible(entry->wait,
+					      atomic_read(&entry->granted));
+		if (rc != 0)
+			return rc;
+	}
+
+	if (put_user(1, (int __user *) buf) != 0)
+		return -EFAULT;
+	return sizeof(int);
+}
+
+static int orientlock_fd_release(struct inode *inode, struct file *file)
+{
+	struct lock_entry *entry = file->private_data;
+
+	if (entry == NULL || cancel_waiter(entry))
+		return 0;
+
+	release_lock(entry);
+	return 0;
+}
+
+static const struct file_operations orientlock_fops = {
+	.release	= orientlock_fd_release,
+	.poll		= orientlock_fd_poll,
+	.read		= orientlock_fd_read,
+	.llseek		= noop_llseek,
+};
+
+/*
+ * Queues a lock request of the given type without sleeping and
+ * returns an fd that becomes readable when it is granted.
+ * flags may contain O_CLOEXEC and O_NONBLOCK.
+ */
+SYSCALL_DEFINE3(orientlock_fd, struct orientation_range __user *, orient,
+		int, type, int, flags)
+{
+	struct lock_entry *entry;
+	struct file *file;
+	int fd, rc;
+
+	if (type != READER_ENTRY && type != WRITER_ENTRY)
+		return -EINVAL;
+	if (flags & ~(O_CLOEXEC | O_NONBLOCK))
+		return -EINVAL;
+
+	entry = alloc_lock_entry(orient, type);
+	if (IS_ERR(entry))
+		return PTR_ERR(entry);
+
+	fd = get_unused_fd_flags(flags & O_CLOEXEC);
+	if (fd < 0) {
+		free_lock_entry(entry);
+		return fd;
+	}
+
+	file = anon_inode_getfile("[orientlock]", &orientlock_fops, entry,
+				  O_RDONLY | (flags & O_NONBLOCK));
+	if (IS_ERR(file)) {
+		put_unused_fd(fd);
+		free_lock_entry(entry);
+		return PTR_ERR(file);
+	}
+	entry->file = file;
+
+	rc = enqueue_waiters(&entry, 1);
+	if (rc != 0) {
+		/* Not queued yet, so keep ->release from touching it */
+		file->private_data = NULL;
+		fput(file);
+		put_unused_fd(fd);
+		free_lock_entry(entry);
+		return rc;
+	}
+
+	fd_install(fd, file);
+	return fd;
+}
+
+/*
+ * Returns 0 if the requests of a batch can all be held at once,
+ * i.e. no written range overlaps another range of the batch.
+ */
+static int check_batch(struct lock_entry **entries, int count)
+{
+	int i, j;
+
+	for (i = 0; i < count; i++) {
+		for (j = i + 1; j < count; j++) {
+			if (!bounds_overlap(&entries[i]->ow.bounds,
+					    &entries[j]->ow.bounds))
+				continue;
+			if (entries[i]->ow.type == WRITER_ENTRY ||
+			    entries[j]->ow.type == WRITER_ENTRY)
+				return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Acquires every lock described by reqs, or none of them. The
+ * requests are queued as a batch that the grant pass only grants
+ * once all of them are in range and free, and the caller sleeps
+ * once for the whole batch.
+ */
+SYSCALL_DEFINE2(orientlock_batch, struct orientlock_request __user *, reqs,
+		int, count)
+{
+	struct lock_entry **entries;
+	int i, type, rc;
+
+	if (count <= 0 || count > ORIENTLOCK_BATCH_MAX)
+		return -EINVAL;
+
+	entries = kmalloc(count * sizeof(struct lock_entry *), GFP_KERNEL);
+	if (entries == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++) {
+		rc = -EFAULT;
+		if (get_user(type, &reqs[i].type) != 0)
+			goto out_free;
+		rc = -EINVAL;
+		if (type != READER_ENTRY && type != WRITER_ENTRY)
+			goto out_free;
+
+		entries[i] = alloc_lock_entry(&reqs[i].range, type);
+		if (IS_ERR(entries[i])) {
+			rc = PTR_ERR(entries[i]);
+			goto out_free;
+		}
+		if (i > 0)
+			list_add_tail(&entries[i]->batch, &entries[0]->batch);
+	}
+	entries[0]->batch_head = 1;
+
+	rc = check_batch(entries, count);
+	if (rc != 0)
+		goto out_free;
+
+	rc = enqueue_waiters(entries, count);
+	if (rc != 0)
+		goto out_free;
+
+	/* pass_publish() publishes the batch head last, so wait on it */
+	rc = wait_for_grant(entries[0]);
+	if (rc != 0 && !cancel_waiter(entries[0]))
+		rc = 0;
+	kfree(entries);
+	return rc;
+
+out_free:
+	while (--i >= 0)
+		free_lock_entry(entries[i]);
+	kfree(entries);
+	return rc;
+}
+
+/*
+ * Releases the caller's granted lock of the given type on korient.
+ * Read locks must be released by the task that took them.
+ * Returns 1 if a lock was released and 0 otherwise.
+ */
+static int orientunlock(struct orientation_range *korient, int type)
+{
+	struct granted_bucket *bucket = granted_bucket(korient);
+	struct granted_range *grange;
+	struct lock_entry *entry;
+	int did_unlock = 0;
+
+	spin_lock(&bucket->lock);
+	grange = find_granted_range(bucket, korient);
+	if (grange == NULL)
+		goto out;
+
+	list_for_each_entry(entry, &grange->holders, granted_list) {
+		/* Locks taken through an fd are released by closing it */
+		if (entry->ow.type != type || entry->file != NULL)
+			continue;
+		/* Unlock is to be done original locking pid process */
+		if (type == READER_ENTRY && entry->pid != current->pid)
+			continue;
+
+		/* Claimed here, so a racing unlock cannot find it too */
+		list_del_init(&entry->granted_list);
+		did_unlock = 1;
+		break;
+	}
+out:
+	spin_unlock(&bucket->lock);
+	if (did_unlock)
+		release_lock(entry);
+	return did_unlock;
+}
+
+SYSCALL_DEFINE1(orientunlock_read, struct orientation_range __user *, orient)
+{
+	struct orientation_range korient;
+
+	if (copy_from_user(&korient, orient,
+				sizeof(struct orientation_range)) != 0)
+		return -EFAULT;
+
+	if (!orientunlock(&korient, READER_ENTRY)) /* failed to unlocked */
+		return -1;
+	else
+		return 0;
+}
+
+SYSCALL_DEFINE1(orientunlock_write, struct orientation_range __user *, orient)
+{
+	struct orientation_range korient;
+
+	if (copy_from_user(&korient, orient,
+				sizeof(struct orientation_range)) != 0)
+		return -EFAULT;
+
+	if (!orientunlock(&korient, WRITER_ENTRY))
+		printk("Undefined error\n");
+	return 0;
+}
+
+/*
+ * Releases every lock described by reqs. Keeps going past ranges
+ * that are not held and reports -EINVAL for them at the end.
+ */
+SYSCALL_DEFINE2(orientunlock_batch, struct orientlock_request __user *, reqs,
+		int, count)
+{
+	struct orientlock_request req;
+	int i, rc = 0;
+
+	if (count <= 0 || count > ORIENTLOCK_BATCH_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < count; i++) {
+		if (copy_from_user(&req, &reqs[i],
+					sizeof(struct orientlock_request)) != 0)
+			return -EFAULT;
+		if (!orientunlock(&req.range, req.type))
+			rc = -EINVAL;
+	}
+	return rc;
+}
+
+/*
+ * Takes a granted lock off its range's holders, as orientunlock()
+ * does, so only one releaser frees it.
+ * Returns 0 if another task's unlock claimed it first.
+ */
+static int claim_granted(struct lock_entry *entry)
+{
+	struct granted_bucket *bucket = entry->grange->bucket;
+	int claimed;
+
+	spin_lock(&bucket->lock);
+	claimed = !list_empty(&entry->granted_list);
+	list_del_init(&entry->granted_list);
+	spin_unlock(&bucket->lock);
+	return claimed;
+}
+
+/*
+ * Called from do_exit(): releases the locks tsk still holds and
+ * withdraws the requests it was waiting on, so a dead owner's locks
+ * are freed right away rather than by the next sensor update.
+ * Locks owned by an orientlock fd are left to the fd.
+ *
+ * With every shard lock held no grant pass is running, so each
+ * request is either waiting or granted for good. Granted locks are
+ * claimed under their bucket lock, since another task's writer
+ * unlock may be releasing them; those are left to that task, and
+ * tsk waits for it to take them off its list before going away.
+ */
+void exit_orientation_locks(struct task_struct *tsk)
+{
+	struct lock_entry *entry, *next;
+	LIST_HEAD(waiting);
+	LIST_HEAD(claimed);
+	int empty;
+
+	if (list_empty(&tsk->orient_locks))
+		return;
+
+	lock_waiter_shards();
+	spin_lock(&tsk->orient_locks_lock);
+	list_for_each_entry_safe(entry, next, &tsk->orient_locks, task_list) {
+		if (!atomic_read(&entry->granted))
+			list_move_tail(&entry->task_list, &waiting);
+		else if (claim_granted(entry))
+			list_move_tail(&entry->task_list, &claimed);
+		else
+			continue;
+		entry->owner = NULL;
+	}
+	spin_unlock(&tsk->orient_locks_lock);
+
+	list_for_each_entry_safe(entry, next, &waiting, task_list)
+		withdraw_waiter(entry);
+	unlock_waiter_shards();
+
+	list_for_each_entry_safe(entry, next, &claimed, task_list) {
+		trace_orientlock_reclaim(entry);
+		release_lock(entry);
+	}
+
+	for (;;) {
+		spin_lock(&tsk->orient_locks_lock);
+		empty = list_empty(&tsk->orient_locks);
+		spin_unlock(&tsk->orient_locks_lock);
+		if (empty)
+			break;
+		cond_resched();
+	}
+}
+
+static void orientlock_show_hist(struct seq_file *m, const char *name,
+				 unsigned long *hist)
+{
+	int i;
+
+	seq_printf(m, "%s:", name);
+	for (i = 0; i < ORIENT_HIST_BUCKETS; i++)
+		seq_printf(m, " %lu", hist[i]);
+	seq_putc(m, '\n');
+}
+
+static int orientlock_stats_show(struct seq_file *m, void *v)
+{
+	struct orientlock_stats sum;
+	struct granted_range *grange;
+	struct hlist_node *pos;
+	int cpu, i;
+
+	memset(&sum, 0, sizeof(sum));
+	for_each_possible_cpu(cpu) {
+		struct orientlock_stats *st = &per_cpu(orientlock_stats, cpu);
+
+		sum.set_orientation += st->set_orientation;
+		sum.coalesced += st->coalesced;
+		sum.passes += st->passes;
+		sum.suppressed += st->suppressed;
+		sum.waits += st->waits;
+		sum.grants += st->grants;
+		sum.releases += st->releases;
+		sum.scanned += st->scanned;
+		sum.matched += st->matched;
+		for (i = 0; i < ORIENT_HIST_BUCKETS; i++) {
+			sum.wait_hist[i] += st->wait_hist[i];
+			sum.hold_hist[i] += st->hold_hist[i];
+			sum.scan_hist[i] += st->scan_hist[i];
+		}
+	}
+
+	seq_printf(m, "set_orientation: %lu\n", sum.set_orientation);
+	seq_printf(m, "coalesced: %lu\n", sum.coalesced);
+	seq_printf(m, "grant_passes: %lu\n", sum.passes);
+	seq_printf(m, "suppressed: %lu\n", sum.suppressed);
+	seq_printf(m, "waits: %lu\n", sum.waits);
+	seq_printf(m, "grants: %lu\n", sum.grants);
+	seq_printf(m, "releases: %lu\n", sum.releases);
+	seq_printf(m, "waiters_scanned: %lu\n", sum.scanned);
+	seq_printf(m, "waiters_matched: %lu\n", sum.matched);
+	orientlock_show_hist(m, "wait_usecs_log2", sum.wait_hist);
+	orientlock_show_hist(m, "hold_usecs_log2", sum.hold_hist);
+	orientlock_show_hist(m, "scan_nodes_log2", sum.scan_hist);
+
+	seq_puts(m, "\n# azimuth pitch roll +/-azimuth +/-pitch +/-roll (Q16) "
+		 "readers writer requests grants\n");
+	for (i = 0; i < GRANTED_HASH_SIZE; i++) {
+		spin_lock(&granted_table[i].lock);
+		hlist_for_each_entry(grange, pos, &granted_table[i].head,
+				     hash) {
+			struct orientation_range *r = &grange->range;
+
+			seq_printf(m, "%d %d %d %u %u %u %d %d %lu %lu\n",
+				   r->orient.azimuth, r->orient.pitch,
+				   r->orient.roll, r->azimuth_range,
+				   r->pitch_range, r->roll_range,
+				   atomic_read(&grange->readers),
+				   grange->writer,
+				   grange->requests, grange->grants);
+		}
+		spin_unlock(&granted_table[i].lock);
+	}
+	return 0;
+}
+
+static int orientlock_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, orientlock_stats_show, NULL);
+}
+
+static const struct file_operations orientlock_stats_fops = {
+	.open		= orientlock_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init orientation_init(void)
+{
+	int i, axis;
+
+	for (i = 0; i < GRANTED_HASH_SIZE; i++) {
+		spin_lock_init(&granted_table[i].lock);
+		INIT_HLIST_HEAD(&granted_table[i].head);
+	}
+	for (i = 0; i < WAITER_SHARDS; i++) {
+		struct waiter_shard *shard = &waiter_shards[i];
+
+		spin_lock_init(&shard->lock);
+		INIT_LIST_HEAD(&shard->list);
+		shard->tree = RB_ROOT;
+		for (axis = 0; axis < ORIENT_AXES; axis++)
+			shard->edges[axis] = RB_ROOT;
+		INIT_LIST_HEAD(&shard->starved);
+	}
+
+	lock_entry_cachep = KMEM_CACHE(lock_entry, SLAB_PANIC);
+	/* One pass at a time, ahead of normal work */
+	orient_wq = alloc_workqueue("orientlock",
+				    WQ_NON_REENTRANT | WQ_HIGHPRI, 1);
+	if (orient_wq == NULL)
+		orient_wq = system_nrt_wq;
+	proc_create("orientlock", 0444, NULL, &orientlock_stats_fops);
 	return 0;
 }
+core_initcall(orientation_init);
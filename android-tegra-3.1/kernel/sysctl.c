@@ -57,6 +57,7 @@
 #include <linux/pipe_fs_i.h>
 #include <linux/oom.h>
 #include <linux/kmod.h>
+#include <linux/orientation.h>
 
 #include <asm/uaccess.h>
 #include <asm/processor.h>
@@ -674,6 +675,31 @@ static struct ctl_table kern_table[] = {
 		.mode		= 0644,
 		.proc_handler	= proc_dointvec,
 	},
+	{
+		.procname	= "orientlock_policy",
+		.data		= &sysctl_orientlock_policy,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+		.extra2		= &two,
+	},
+	{
+		.procname	= "orientlock_max_bypass",
+		.data		= &sysctl_orientlock_max_bypass,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &one,
+	},
+	{
+		.procname	= "orientlock_deadband",
+		.data		= &sysctl_orientlock_deadband,
+		.maxlen		= ORIENT_AXES*sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+	},
 #if defined CONFIG_PRINTK
 	{
 		.procname	= "printk",
@@ -12,24 +12,44 @@
 #ifndef ORIENT_H_
 #define ORIENT_H_
 
+#include <stdint.h>
+
+/* Angles are Q16 fixed point: degrees * ORIENT_ONE */
+#define ORIENT_FRAC_BITS 16
+#define ORIENT_ONE (1 << ORIENT_FRAC_BITS)
+#define ORIENT_DEG(deg) ((deg) * ORIENT_ONE)
+#define ORIENT_FROM_FLOAT(deg) ((int) lrintf((deg) * ORIENT_ONE))
 
 struct dev_orientation {
 	int azimuth; /* angle between the magnetic north
 	                and the Y axis, around the Z axis
-	                (0<=azimuth<360)
+	                (0<=azimuth<360), Q16
 	                0=North, 90=East, 180=South, 270=West */
-	int pitch;   /* rotation around the X-axis: -180<=pitch<=180 */
+	int pitch;   /* rotation around the X-axis: -180<=pitch<=180, Q16 */
 	int roll;    /* rotation around Y-axis: +Y == -roll,
-	                -90<=roll<=90 */
+	                -90<=roll<=90, Q16 */
 };
 
 struct orientation_range {
 	struct dev_orientation orient;  /* device orientation */
-	unsigned int azimuth_range;     /* +/- degrees around Z-axis */
-	unsigned int pitch_range;       /* +/- degrees around X-axis */
-	unsigned int roll_range;        /* +/- degrees around Y-axis */
+	unsigned int azimuth_range;     /* +/- Q16 degrees around Z-axis */
+	unsigned int pitch_range;       /* +/- Q16 degrees around X-axis */
+	unsigned int roll_range;        /* +/- Q16 degrees around Y-axis */
 };
 
+/* orientation_sample and the trace file format */
+#include "orient_trace.h"
+
+/* Most samples one set_orientation_batch call takes */
+#define ORIENT_SAMPLES_MAX 16
 
+#define ORIENT_AXES 3
+
+/* What the pending lock requests need, from orientlock_demand */
+struct orientlock_demand {
+	int waiters; /* lock requests waiting to be granted */
+	/* narrowest +/- range waited on per axis, Q16; UINT_MAX if none */
+	unsigned int min_range[ORIENT_AXES];
+};
 
 #endif /* ORIENT_H_ */
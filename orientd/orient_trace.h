@@ -0,0 +1,31 @@
+/*
+ * orient_trace.h
+ *
+ * Recorded orientation traces (orientd -r, sensorsim -p): a header
+ * followed by struct orientation_sample records, native byte order,
+ * in non-decreasing timestamp order. Read back by test/lockmodel.
+ *
+ * Include after a definition of struct dev_orientation, from
+ * orient.h or test/orient_lock.h.
+ */
+#ifndef ORIENT_TRACE_H_
+#define ORIENT_TRACE_H_
+
+#include <stdint.h>
+
+/* One timestamped sensor reading for set_orientation_batch */
+struct orientation_sample {
+	int64_t timestamp; /* nanoseconds, from sensors_event_t */
+	struct dev_orientation orient;
+};
+
+#define ORIENT_TRACE_MAGIC 0x5254524fU /* "ORTR" */
+#define ORIENT_TRACE_VERSION 1
+
+struct orient_trace_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size; /* sizeof(struct orientation_sample) */
+};
+
+#endif /* ORIENT_TRACE_H_ */
@@ -6,6 +6,7 @@
  */
 #include <bionic/errno.h> /* Google does things a little different...*/
 #include <fcntl.h>
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,6 +33,17 @@
 /* the period at which the orientation sensor will update */
 #define ORIENTATION_UPDATE_PERIOD_MS 500
 
+/*
+ * While locks are pending the period shrinks with the narrowest range
+ * waited on, down to ORIENTATION_MIN_PERIOD_MS; with no waiters the
+ * compass only keeps get_orientation() roughly current. The kernel
+ * checks a new request against the last sample as soon as it is
+ * queued, so the idle period does not delay its grant.
+ */
+#define ORIENTATION_MIN_PERIOD_MS 20
+#define ORIENTATION_MS_PER_DEGREE 10
+#define ORIENTATION_IDLE_PERIOD_MS 2000
+
 /* set to 1 for a bit of debug output */
 #if 1
 	#define dbg_compass(fmt, ...) printf("compass: " fmt, ## __VA_ARGS__)
@@ -40,40 +52,161 @@
 #endif
 
 static int effective_sensor;
+static int sampling_period_ms = -1;
+static FILE *trace_file; /* set by -r <file> */
 
 /* helper functions which you should use */
 static int open_compass(struct sensors_module_t **hw_module,
 			struct sensors_poll_device_t **poll_device);
 static void enumerate_sensors(const struct sensors_module_t *sensors);
 
+/*
+ * Starts a trace that record_samples() appends to. Returns -1 if
+ * the file cannot be created.
+ */
+static int open_trace(const char *path)
+{
+	struct orient_trace_header hdr;
+
+	trace_file = fopen(path, "wb");
+	if (trace_file == NULL)
+		return -1;
+
+	hdr.magic = ORIENT_TRACE_MAGIC;
+	hdr.version = ORIENT_TRACE_VERSION;
+	hdr.record_size = sizeof(struct orientation_sample);
+	/* Flushed now, or the forked daemon would write it again */
+	if (fwrite(&hdr, sizeof(hdr), 1, trace_file) != 1 ||
+	    fflush(trace_file) != 0) {
+		fclose(trace_file);
+		trace_file = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Appends one poll's samples to the trace. The batch is flushed
+ * straight away so a killed daemon still leaves a usable trace.
+ */
+static void record_samples(const struct orientation_sample *samples,
+			   int nr_samples)
+{
+	if (trace_file == NULL)
+		return;
+
+	if (fwrite(samples, sizeof(*samples), nr_samples, trace_file) !=
+	    (size_t)nr_samples || fflush(trace_file) != 0) {
+		perror("Failed to record trace, recording stopped");
+		fclose(trace_file);
+		trace_file = NULL;
+	}
+}
+
+/*
+ * Reads whatever events the sensors have and pushes the compass
+ * ones to the kernel in a single set_orientation_batch call (389),
+ * in the order the HAL returned them.
+ * Returns 1 if the kernel says the lock demand changed, 0 if not or
+ * if there was nothing to push, -1 on error.
+ */
 static int poll_sensor_data(struct sensors_poll_device_t *sensors_device)
 {
-    const size_t numEventMax = 16;
+    const size_t numEventMax = ORIENT_SAMPLES_MAX;
     const size_t minBufferSize = numEventMax;
     sensors_event_t buffer[minBufferSize];
+	struct orientation_sample samples[ORIENT_SAMPLES_MAX];
 	ssize_t count = sensors_device->poll(sensors_device, buffer, minBufferSize);
-	int i;
+	int i, nr_samples = 0;
 	for (i = 0; i < count; ++i) {
 		/* Find compass sensor */
 		if (buffer[i].sensor != effective_sensor)
 			continue;
-		
-		struct dev_orientation orient;
-		orient.azimuth = buffer[i].orientation.azimuth;
-		orient.pitch = buffer[i].orientation.pitch;
-		orient.roll = buffer[i].orientation.roll;
-		
-		int rc;
-		rc = syscall(376, &orient);
-		if (rc != 0)
-			perror("Failed to update kernel");
+
+		struct orientation_sample *sample = &samples[nr_samples++];
+		sample->timestamp = buffer[i].timestamp;
+		sample->orient.azimuth =
+			ORIENT_FROM_FLOAT(buffer[i].orientation.azimuth);
+		sample->orient.pitch =
+			ORIENT_FROM_FLOAT(buffer[i].orientation.pitch);
+		sample->orient.roll =
+			ORIENT_FROM_FLOAT(buffer[i].orientation.roll);
 
 		/* At this point we should have valid data */
 		dbg_compass("Orientation: azimuth= %0.2f, pitch= %0.2f, "
 			"roll= %0.2f\n", buffer[i].orientation.azimuth,
 			buffer[i].orientation.pitch, buffer[i].orientation.roll);
 	}
-	return 0;
+
+	if (nr_samples == 0)
+		return 0;
+
+	record_samples(samples, nr_samples);
+
+	int rc;
+	rc = syscall(389, samples, nr_samples);
+	if (rc < 0)
+		perror("Failed to update kernel");
+	return rc;
+}
+
+/*
+ * Picks the sampling period for the current kernel demand: fast
+ * only while lock requests are pending, and the faster the
+ * narrower the range they wait on.
+ */
+static int demand_to_period_ms(const struct orientlock_demand *demand)
+{
+	unsigned int narrowest = UINT_MAX;
+	int axis, period;
+
+	if (demand->waiters == 0)
+		return ORIENTATION_IDLE_PERIOD_MS;
+
+	for (axis = 0; axis < ORIENT_AXES; axis++) {
+		if (demand->min_range[axis] < narrowest)
+			narrowest = demand->min_range[axis];
+	}
+	if (narrowest == UINT_MAX) /* only "any orientation" ranges */
+		return ORIENTATION_UPDATE_PERIOD_MS;
+
+	period = (narrowest / ORIENT_ONE) * ORIENTATION_MS_PER_DEGREE;
+	if (period < ORIENTATION_MIN_PERIOD_MS)
+		period = ORIENTATION_MIN_PERIOD_MS;
+	if (period > ORIENTATION_UPDATE_PERIOD_MS)
+		period = ORIENTATION_UPDATE_PERIOD_MS;
+	return period;
+}
+
+/*
+ * Keeps only the compass active, at the given period. open_compass()
+ * turns every sensor on, but nothing else is ever read.
+ */
+static void set_sampling_period(struct sensors_module_t *sensors_module,
+				struct sensors_poll_device_t *sensors_device,
+				int period_ms)
+{
+	const struct sensor_t *list;
+	ssize_t count;
+	int i;
+
+	if (period_ms == sampling_period_ms)
+		return;
+
+	count = sensors_module->get_sensors_list(sensors_module, &list);
+	for (i = 0; i < count; i++) {
+		int wanted = list[i].handle == effective_sensor;
+
+		/* Only deactivate the others the first time round */
+		if (wanted || sampling_period_ms < 0)
+			sensors_device->activate(sensors_device,
+						 list[i].handle, wanted);
+		if (wanted)
+			sensors_device->setDelay(sensors_device,
+				list[i].handle, period_ms * 1000000LL);
+	}
+	dbg_compass("sampling every %d ms\n", period_ms);
+	sampling_period_ms = period_ms;
 }
 
 /* entry point of orientd: fill in daemon implementation
@@ -84,6 +217,15 @@ int main(int argc, char **argv)
 	struct sensors_module_t *sensors_module = NULL;
 	struct sensors_poll_device_t *sensors_device = NULL;
 
+	/* orientd -r <file> records every sample it pushes */
+	if (argc > 2 && strcmp(argv[1], "-r") == 0) {
+		if (open_trace(argv[2]) < 0) {
+			perror("Failed to create trace");
+			return EXIT_FAILURE;
+		}
+		printf("Recording orientation trace to %s\n", argv[2]);
+	}
+
 	/* open and initialize the orientation sensor */
 	printf("Opening sensors...\n");
 	if (open_compass(&sensors_module,
@@ -106,8 +248,24 @@ int main(int argc, char **argv)
 	}
 	/* Fill in daemon implementation around here */
 	printf("turn me into a daemon!\n");
+	int demand_changed = 1, demand_failed;
 	while (1) {
-		poll_sensor_data(sensors_device);
+		struct orientlock_demand demand;
+
+		/* Ask what the waiters need only once the kernel says it
+		 * changed, so a poll stays one syscall */
+		demand_failed = 0;
+		if (demand_changed) {
+			if (syscall(390, &demand) != 0) {
+				perror("Failed to read lock demand");
+				demand.waiters = 0;
+				demand_failed = 1;
+			}
+			set_sampling_period(sensors_module, sensors_device,
+					    demand_to_period_ms(&demand));
+		}
+		demand_changed = poll_sensor_data(sensors_device) > 0 ||
+			demand_failed;
 	}
 
 	return EXIT_SUCCESS;
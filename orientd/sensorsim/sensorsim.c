@@ -24,6 +24,8 @@
 #include <hardware/sensors.h>
 #include <hardware/qemud.h>
 
+#include "../orient.h"
+
 #if 0
 	#define dbg(fmt, ...) printf("[D:%s:%d] " fmt "\n", __FUNCTION__, \
 					__LINE__, ## __VA_ARGS__)
@@ -87,14 +89,51 @@ static const struct {
 /* informational description of each sensor */
 static const struct sensor_t s_availableSensors[];
 
+/*
+ * A connection to sensorsimulator.java. Replies are read through a
+ * ring buffer filled with as much as each recv() returns, so a line
+ * costs a fraction of a syscall instead of one per byte.
+ */
+#define SOCKET_BUF_SZ 4096 /* must be a power of two */
+
+struct sensorsim_conn {
+	int sock;
+	char buf[SOCKET_BUF_SZ];
+	size_t head; /* index of the first unread byte */
+	size_t count; /* number of unread bytes */
+};
+
 /*
  * sensorsimulator interface functions
  */
-static int sensorsimulator_open_socket(char *ip, int port);
-static int sensorsimulator_enable_sensor(int sock, int sensor_id);
-static int sensorsimulator_get_params(int sock, int sensor_id,
+static struct sensorsim_conn *sensorsimulator_open_socket(char *ip, int port);
+static void sensorsimulator_close(struct sensorsim_conn *conn);
+static int sensorsimulator_enable_sensor(struct sensorsim_conn *conn,
+					 int sensor_id);
+static int sensorsimulator_request_params(struct sensorsim_conn *conn,
+					  int sensor_id);
+static int sensorsimulator_get_params(struct sensorsim_conn *conn,
+				      int sensor_id, int pipeline,
 				      float *x, float *y, float *z);
 
+/*
+ * Playback of a trace recorded by orientd -r. speed scales the
+ * recorded gaps between samples: 1 plays in real time, 2 twice as
+ * fast, and 0 as fast as qemud takes them.
+ */
+struct trace_player {
+	FILE *fp;
+	double speed;
+	int64_t first_stamp;
+	int64_t start_ns; /* CLOCK_MONOTONIC when the first sample went */
+	unsigned long played;
+};
+
+static int trace_open(struct trace_player *tp, const char *path,
+		      double speed);
+static int trace_next(struct trace_player *tp, float *x, float *y, float *z);
+static void trace_close(struct trace_player *tp);
+
 static const char *sensorId_to_name(int id)
 {
 	int nn;
@@ -239,7 +278,9 @@ int main(int argc, char **argv)
 	char command[128];
 	char ip[16];
 	int port;
-	int ssock = -1; /* simulator socket */
+	struct sensorsim_conn *conn = NULL; /* simulator connection */
+	struct trace_player trace = { .fp = NULL };
+	int period_ms = SENSOR_UPDATE_PERIOD_MS;
 	int sensor_id = -1;
 
 	(void)bionic_signal(SIGPIPE, sighandler);
@@ -256,17 +297,28 @@ int main(int argc, char **argv)
 	info("Emulator-enabled sensors:\n");
 	emu_sensors_list(qfd);
 
-	/* if we're passed arguments, use them to connect to
-	   a sensorsimulator.java instance somewhere on the network */
-	if (argc > 2) {
+	/* sensorsim -p <trace> [speed] replays a recorded trace */
+	if (argc > 2 && strcmp(argv[1], "-p") == 0) {
+		double speed = argc > 3 ? atof(argv[3]) : 1.0;
+		if (trace_open(&trace, argv[2], speed) < 0) {
+			err("Error opening trace %s (%s)", argv[2],
+				strerror(errno));
+			goto exit_socket_failure;
+		}
+		sensor_id = ID_ORIENTATION;
+	} else if (argc > 2) {
+		/* if we're passed arguments, use them to connect to
+		   a sensorsimulator.java instance somewhere on the network */
 		strncpy(ip, argv[1], sizeof(ip));
 		port = atoi(argv[2]);
-		ssock = sensorsimulator_open_socket(ip, port);
-		if (ssock < 0) {
+		conn = sensorsimulator_open_socket(ip, port);
+		if (conn == NULL) {
 			err("Error connecting to %s:%d (%s)", ip, port,
 				strerror(errno));
 			goto exit_socket_failure;
 		}
+		if (argc > 4)
+			period_ms = atoi(argv[4]);
 		if (argc > 3)
 			sensor_id = atoi(argv[3]);
 		else {
@@ -278,11 +330,17 @@ int main(int argc, char **argv)
 			err("Invalid SensorID");
 			goto exit_data_error;
 		}
-		if (sensorsimulator_enable_sensor(ssock, sensor_id) < 0) {
+		if (sensorsimulator_enable_sensor(conn, sensor_id) < 0) {
 			err("Error enabling SensorID=%d (%s)", sensor_id,
 			     strerror(errno));
 			goto exit_data_error;
 		}
+		/* keep one readSensor() in flight from here on */
+		if (sensorsimulator_request_params(conn, sensor_id) < 0) {
+			err("Error requesting data from sensorsimulator"
+				" (%s)", strerror(errno));
+			goto exit_data_error;
+		}
 		daemonize();
 	}
 
@@ -293,9 +351,19 @@ int main(int argc, char **argv)
 		float x, y, z;
 		char *sensor_name;
 
-		if (ssock > 0) {
-			usleep(SENSOR_UPDATE_PERIOD_MS * 1000);
-			if (sensorsimulator_get_params(ssock, sensor_id,
+		if (trace.fp != NULL) {
+			rc = trace_next(&trace, &x, &y, &z);
+			if (rc == 0)
+				break;
+			if (rc < 0) {
+				err("Error reading trace (%s)",
+					strerror(errno));
+				goto exit_data_error;
+			}
+		} else if (conn != NULL) {
+			if (period_ms > 0)
+				usleep(period_ms * 1000);
+			if (sensorsimulator_get_params(conn, sensor_id, 1,
 							&x, &y, &z) < 0) {
 				err("Error receiving data from sensorsimulator"
 					" (%s)", strerror(errno));
@@ -314,7 +382,8 @@ int main(int argc, char **argv)
 
 		sensor_name = (char *)sensorId_to_name(sensor_id);
 
-		if (ssock < 0 && sensor_id == ID_ORIENTATION) {
+		if (conn == NULL && trace.fp == NULL &&
+		    sensor_id == ID_ORIENTATION) {
 			/* the user just input X,Y,Z (pitch,roll,azimuth)
 			   the qemu pipe is expecting Z,X,Y (azimuth,pitch,roll)
 			 */
@@ -359,12 +428,14 @@ int main(int argc, char **argv)
 		info("sensorsim exiting at %s\n", ctime_r(&tm, tbuf));
 	}
 
-	close(ssock);
+	trace_close(&trace);
+	sensorsimulator_close(conn);
 	close(qfd);
 	return EXIT_SUCCESS;
 
 exit_data_error:
-	close(ssock);
+	trace_close(&trace);
+	sensorsimulator_close(conn);
 exit_socket_failure:
 	close(qfd);
 	return EXIT_FAILURE;
@@ -385,12 +456,39 @@ void sighandler(int sig)
 }
 
 /*
- * an inefficient way to read a line from a socket
+ * Refills the ring buffer with whatever the socket has, up to the
+ * free space before the buffer wraps. Returns the number of bytes
+ * read, or -1 on error or when the server closed the connection.
+ */
+static int socket_fill(struct sensorsim_conn *conn)
+{
+	size_t tail = (conn->head + conn->count) & (SOCKET_BUF_SZ - 1);
+	size_t room = SOCKET_BUF_SZ - conn->count;
+	ssize_t rc;
+
+	if (tail + room > SOCKET_BUF_SZ)
+		room = SOCKET_BUF_SZ - tail;
+
+	do {
+		rc = recv(conn->sock, conn->buf + tail, room, 0);
+	} while (rc < 0 && errno == EINTR);
+	if (rc == 0)
+		errno = ECONNRESET;
+	if (rc <= 0)
+		return -1;
+
+	conn->count += rc;
+	return rc;
+}
+
+/*
+ * Reads one line from the connection into *line, growing it as
+ * needed. Bytes past the newline stay buffered for the next call.
  */
-int socket_readline(int sockfd, char **line, size_t *linesz)
+int socket_readline(struct sensorsim_conn *conn, char **line, size_t *linesz)
 {
 	static const int INIT_BUF_SZ = 128;
-	int pos = 0;
+	size_t pos = 0;
 	if (*line == NULL) {
 		*line = malloc(INIT_BUF_SZ);
 		*linesz = INIT_BUF_SZ;
@@ -398,9 +496,13 @@ int socket_readline(int sockfd, char **line, size_t *linesz)
 
 	while (1) {
 		char ch;
-		if (recv(sockfd, &ch, sizeof(ch), 0) < 0)
+		if (conn->count == 0 && socket_fill(conn) < 0)
 			return -1;
 
+		ch = conn->buf[conn->head];
+		conn->head = (conn->head + 1) & (SOCKET_BUF_SZ - 1);
+		conn->count--;
+
 		if (pos == *linesz) {
 			*linesz *= 2;
 			*line = realloc(*line, *linesz);
@@ -408,7 +510,7 @@ int socket_readline(int sockfd, char **line, size_t *linesz)
 
 		if (ch == '\n') {
 			/* overwrite \r (combines \r\n in one!) */
-			if ((*line)[pos-1] == '\r')
+			if (pos > 0 && (*line)[pos-1] == '\r')
 				--pos;
 			(*line)[pos] = '\0';
 			return pos; /* don't include the NULL (strlen style) */
@@ -418,15 +520,31 @@ int socket_readline(int sockfd, char **line, size_t *linesz)
 	}
 }
 
-static int sensorsimulator_open_socket(char *ip, int port)
+static void sensorsimulator_close(struct sensorsim_conn *conn)
+{
+	if (conn == NULL)
+		return;
+	close(conn->sock);
+	free(conn);
+}
+
+static struct sensorsim_conn *sensorsimulator_open_socket(char *ip, int port)
 {
 	struct sockaddr_in addr;
+	struct sensorsim_conn *conn;
 	char *line = NULL;
 	size_t linesz = 0;
 
 	int sock = socket(AF_INET, SOCK_STREAM, 0);
 	if (sock < 0)
-		return -1;
+		return NULL;
+
+	conn = calloc(1, sizeof(*conn));
+	if (conn == NULL) {
+		close(sock);
+		return NULL;
+	}
+	conn->sock = sock;
 
 	info("Connecting to %s:%d...\n", ip, port);
 	memset(&addr, 0, sizeof(addr));
@@ -440,7 +558,7 @@ static int sensorsimulator_open_socket(char *ip, int port)
 
 	/* read the server response string to verify that we've
 	   connected to the sensorsimulator application */
-	if (socket_readline(sock, &line, &linesz) < 0)
+	if (socket_readline(conn, &line, &linesz) < 0)
 		goto sock_err;
 
 	if (strcmp(line, "SensorSimulator") != 0) {
@@ -449,15 +567,17 @@ static int sensorsimulator_open_socket(char *ip, int port)
 		goto sock_err;
 	}
 
-	return sock;
+	free(line);
+	return conn;
 
 sock_err:
 	free(line);
-	close(sock);
-	return -1;
+	sensorsimulator_close(conn);
+	return NULL;
 }
 
-static int sensorsimulator_enable_sensor(int sock, int sensor_id)
+static int sensorsimulator_enable_sensor(struct sensorsim_conn *conn,
+					 int sensor_id)
 {
 	char cmd[128];
 	char *line = NULL;
@@ -466,35 +586,58 @@ static int sensorsimulator_enable_sensor(int sock, int sensor_id)
 	snprintf(cmd, sizeof(cmd), "enableSensor()\n%s\n",
 		 sensorId_to_name(sensor_id));
 
-	if (send(sock, cmd, strlen(cmd), 0) < 0)
+	if (send(conn->sock, cmd, strlen(cmd), 0) < 0) {
+		free(line);
 		return -1;
+	}
 
-	if (socket_readline(sock, &line, &linesz) < 0)
+	if (socket_readline(conn, &line, &linesz) < 0) {
+		free(line);
 		return -1;
+	}
 
 	dbg("[Enable %d]: Previous state was: %s\n", sensor_id, line);
 	free(line);
 	return 0;
 }
 
-static int sensorsimulator_get_params(int sock, int sensor_id,
-				float *x, float *y, float *z)
+/* Sends a readSensor() request; the reply is read by get_params */
+static int sensorsimulator_request_params(struct sensorsim_conn *conn,
+					  int sensor_id)
 {
 	char cmd[128];
-	char *line = NULL;
-	size_t linesz = 0;
-	int numvals = 0, n = 0, rc = 0;
 
 	snprintf(cmd, sizeof(cmd), "readSensor()\n%s\n",
 		 sensorId_to_name(sensor_id));
 
-	if (send(sock, cmd, strlen(cmd), 0) < 0)
+	if (send(conn->sock, cmd, strlen(cmd), 0) < 0)
 		return -1;
+	return 0;
+}
+
+/*
+ * Reads the reply to the outstanding readSensor() request. With
+ * pipeline set, the request for the next sample is sent as soon as
+ * the reply has been received and before it is parsed, so the
+ * server works on it while we forward this one.
+ */
+static int sensorsimulator_get_params(struct sensorsim_conn *conn,
+				      int sensor_id, int pipeline,
+				      float *x, float *y, float *z)
+{
+	char *lines[3] = { NULL, NULL, NULL };
+	size_t linesz[3] = { 0, 0, 0 };
+	int numvals = 0, n = 0, rc = 0;
 
-	if (socket_readline(sock, &line, &linesz) < 0)
+	if (!pipeline && sensorsimulator_request_params(conn, sensor_id) < 0)
 		return -1;
 
-	numvals = atoi(line);
+	if (socket_readline(conn, &lines[0], &linesz[0]) < 0) {
+		rc = -1;
+		goto exit_getparms;
+	}
+
+	numvals = atoi(lines[0]);
 	if (numvals > 3 ||
 	    (numvals < 3 && (sensor_id != ID_TEMPERATURE))) {
 		err("Invalid number of data points for sensor %d, "
@@ -504,13 +647,21 @@ static int sensorsimulator_get_params(int sock, int sensor_id,
 		goto exit_getparms;
 	}
 	for (n = 0; n < numvals; ++n) {
-		float val;
-		if (socket_readline(sock, &line, &linesz) < 0) {
+		if (socket_readline(conn, &lines[n], &linesz[n]) < 0) {
 			rc = -1;
 			goto exit_getparms;
 		}
-		if (sscanf(line, "%g", &val) < 1) {
-			err("Invalid data line: '%s'", line);
+	}
+
+	if (pipeline && sensorsimulator_request_params(conn, sensor_id) < 0) {
+		rc = -1;
+		goto exit_getparms;
+	}
+
+	for (n = 0; n < numvals; ++n) {
+		float val;
+		if (sscanf(lines[n], "%g", &val) < 1) {
+			err("Invalid data line: '%s'", lines[n]);
 			errno = EINVAL;
 			rc = -1;
 			goto exit_getparms;
@@ -533,7 +684,8 @@ static int sensorsimulator_get_params(int sock, int sensor_id,
 	dbg("Sensor values: X=%g, Y=%g, Z=%g\n", *x, *y, *z);
 
 exit_getparms:
-	free(line);
+	for (n = 0; n < 3; ++n)
+		free(lines[n]);
 	return rc;
 }
 
@@ -583,3 +735,87 @@ static const struct sensor_t s_availableSensors[] = {
 	  .reserved   = {}
 	},
 };
+
+static int64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int trace_open(struct trace_player *tp, const char *path,
+		      double speed)
+{
+	struct orient_trace_header hdr;
+
+	tp->fp = fopen(path, "rb");
+	if (tp->fp == NULL)
+		return -1;
+
+	if (fread(&hdr, sizeof(hdr), 1, tp->fp) != 1 ||
+	    hdr.magic != ORIENT_TRACE_MAGIC ||
+	    hdr.version != ORIENT_TRACE_VERSION ||
+	    hdr.record_size != sizeof(struct orientation_sample)) {
+		err("%s is not an orientation trace", path);
+		fclose(tp->fp);
+		tp->fp = NULL;
+		errno = EINVAL;
+		return -1;
+	}
+
+	tp->speed = speed < 0 ? 0 : speed;
+	tp->played = 0;
+	if (tp->speed > 0)
+		info("Replaying %s at %gx recorded pace", path, tp->speed);
+	else
+		info("Replaying %s at full speed", path);
+	return 0;
+}
+
+/*
+ * Fetches the next sample as azimuth/pitch/roll floats, sleeping until
+ * its (scaled) offset from the first sample has elapsed. Returns 1 for
+ * a sample, 0 at the end of the trace and -1 on error.
+ */
+static int trace_next(struct trace_player *tp, float *x, float *y, float *z)
+{
+	struct orientation_sample sample;
+
+	if (fread(&sample, sizeof(sample), 1, tp->fp) != 1) {
+		if (ferror(tp->fp))
+			return -1;
+		return 0;
+	}
+
+	if (tp->played == 0) {
+		tp->first_stamp = sample.timestamp;
+		tp->start_ns = monotonic_ns();
+	} else if (tp->speed > 0) {
+		/* pace against the start, so sleep overshoot doesn't add up */
+		int64_t due = tp->start_ns + (int64_t)
+			((sample.timestamp - tp->first_stamp) / tp->speed);
+		int64_t wait = due - monotonic_ns();
+		if (wait > 0) {
+			struct timespec ts;
+			ts.tv_sec = wait / 1000000000LL;
+			ts.tv_nsec = wait % 1000000000LL;
+			while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+				;
+		}
+	}
+
+	*x = (float)sample.orient.azimuth / ORIENT_ONE;
+	*y = (float)sample.orient.pitch / ORIENT_ONE;
+	*z = (float)sample.orient.roll / ORIENT_ONE;
+	tp->played++;
+	return 1;
+}
+
+static void trace_close(struct trace_player *tp)
+{
+	if (tp->fp == NULL)
+		return;
+	info("Replayed %lu samples", tp->played);
+	fclose(tp->fp);
+	tp->fp = NULL;
+}
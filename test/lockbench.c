@@ -0,0 +1,358 @@
+/*
+ * lockbench.c
+ *
+ * Orientation lock microbenchmark. Forks N reader and M writer
+ * processes that lock, hold and unlock ranges drawn from a chosen
+ * distribution, while a driver process publishes orientations
+ * through set_orientation at a fixed rate. At the end it reports
+ * acquire latency percentiles, grants per second and CPU cost.
+ *
+ * The driver replaces orientd, so stop orientd before running it.
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "orient_lock.h"
+
+/* Latencies kept per worker; later grants are counted but not kept */
+#define LAT_MAX 8192
+
+#define NSEC_PER_USEC 1000LL
+#define NSEC_PER_SEC 1000000000LL
+
+/* Range distributions */
+#define DIST_FIXED 0 /* every worker locks the same range */
+#define DIST_UNIFORM 1 /* centers spread over the driven path */
+
+struct options {
+	int readers;
+	int writers;
+	int seconds;
+	int rate_hz; /* set_orientation calls per second */
+	int dist;
+	int range_deg; /* +/- range on pitch and roll */
+	int hold_us; /* how long a granted lock is held */
+};
+
+/* What each process reports back, in a shared mapping */
+struct proc_stats {
+	int type; /* READER_ENTRY, WRITER_ENTRY, or -1 for the driver */
+	long grants;
+	long timeouts;
+	long sets; /* driver only */
+	int64_t utime_ns;
+	int64_t stime_ns;
+	int nr_lat;
+	int64_t lat[LAT_MAX]; /* acquire latency, ns */
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-r readers] [-w writers] [-t seconds] "
+		"[-f set_hz]\n"
+		"\t[-D fixed|uniform] [-R range_deg] [-H hold_us]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static struct timespec ns_to_timespec(int64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / NSEC_PER_SEC;
+	ts.tv_nsec = ns % NSEC_PER_SEC;
+	return ts;
+}
+
+static void sleep_ns(int64_t ns)
+{
+	struct timespec ts = ns_to_timespec(ns);
+
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+static void record_rusage(struct proc_stats *stats)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	stats->utime_ns = ru.ru_utime.tv_sec * NSEC_PER_SEC +
+		ru.ru_utime.tv_usec * NSEC_PER_USEC;
+	stats->stime_ns = ru.ru_stime.tv_sec * NSEC_PER_SEC +
+		ru.ru_stime.tv_usec * NSEC_PER_USEC;
+}
+
+/*
+ * The path the driver sweeps: a full turn of azimuth every 10s,
+ * pitch and roll swinging +/-30 degrees.
+ */
+static void driven_orientation(double t, struct dev_orientation *orient)
+{
+	orient->azimuth = orient_from_float(fmod(36 * t, 360));
+	orient->pitch = orient_from_float(30 * sin(2 * M_PI * t / 7));
+	orient->roll = orient_from_float(30 * sin(2 * M_PI * t / 5));
+}
+
+static void run_driver(struct options *opt, struct proc_stats *stats,
+		       int64_t end)
+{
+	int64_t period = NSEC_PER_SEC / opt->rate_hz;
+	int64_t start = now_ns(), next = start;
+
+	while (next < end) {
+		struct dev_orientation orient;
+
+		driven_orientation((double) (next - start) / NSEC_PER_SEC,
+				   &orient);
+		if (orient_set(&orient) != 0) {
+			perror("set_orientation");
+			break;
+		}
+		stats->sets++;
+		/* pace against the start, so late wakeups don't add up */
+		next += period;
+		if (next > now_ns())
+			sleep_ns(next - now_ns());
+	}
+	record_rusage(stats);
+}
+
+static void pick_range(struct options *opt, struct orientation_range *range)
+{
+	memset(range, 0, sizeof(*range));
+	range->pitch_range = ORIENT_DEG(opt->range_deg);
+	range->roll_range = ORIENT_DEG(opt->range_deg);
+	if (opt->dist == DIST_FIXED)
+		return;
+
+	/* azimuth is left as "any"; pitch and roll on the swing */
+	range->orient.pitch = ORIENT_DEG(rand() % 61 - 30);
+	range->orient.roll = ORIENT_DEG(rand() % 61 - 30);
+}
+
+static void run_worker(struct options *opt, struct proc_stats *stats,
+		       int64_t end)
+{
+	struct orientation_range range;
+	int64_t start, left;
+	struct timespec timeout;
+	int rc;
+
+	srand(getpid());
+	while ((left = end - now_ns()) > 0) {
+		pick_range(opt, &range);
+		timeout = ns_to_timespec(left);
+
+		start = now_ns();
+		if (stats->type == WRITER_ENTRY)
+			rc = orient_write_timedlock(&range, &timeout);
+		else
+			rc = orient_read_timedlock(&range, &timeout);
+		if (rc != 0) {
+			if (errno != ETIMEDOUT && errno != EINTR) {
+				perror("orientlock");
+				break;
+			}
+			stats->timeouts++;
+			continue;
+		}
+
+		if (stats->nr_lat < LAT_MAX)
+			stats->lat[stats->nr_lat++] = now_ns() - start;
+		stats->grants++;
+		if (opt->hold_us > 0)
+			sleep_ns(opt->hold_us * NSEC_PER_USEC);
+
+		if (stats->type == WRITER_ENTRY)
+			orient_write_unlock(&range);
+		else
+			orient_read_unlock(&range);
+	}
+	record_rusage(stats);
+}
+
+/* Sums the busy and total jiffies of every CPU from /proc/stat */
+static int read_cpu_jiffies(long long *busy, long long *total)
+{
+	long long v[7];
+	FILE *fp = fopen("/proc/stat", "r");
+	int n;
+
+	if (fp == NULL)
+		return -1;
+	n = fscanf(fp, "cpu %lld %lld %lld %lld %lld %lld %lld", &v[0],
+		   &v[1], &v[2], &v[3], &v[4], &v[5], &v[6]);
+	fclose(fp);
+	if (n != 7)
+		return -1;
+	*total = v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6];
+	*busy = *total - v[3] - v[4]; /* minus idle and iowait */
+	return 0;
+}
+
+static int cmp_lat(const void *a, const void *b)
+{
+	int64_t one = *(const int64_t *) a, two = *(const int64_t *) b;
+
+	return one < two ? -1 : one > two;
+}
+
+static double lat_pct_ms(int64_t *lat, int n, double pct)
+{
+	if (n == 0)
+		return 0;
+	return lat[(int) (pct / 100 * (n - 1) + 0.5)] / 1e6;
+}
+
+/* Prints grants, rate and latency percentiles for one lock type */
+static void report_type(const char *name, int type,
+			struct proc_stats *stats, int nr_procs, double secs)
+{
+	int64_t *lat = malloc(sizeof(*lat) * LAT_MAX * nr_procs);
+	long grants = 0, timeouts = 0;
+	int i, n = 0;
+
+	if (lat == NULL)
+		return;
+	for (i = 0; i < nr_procs; i++) {
+		if (stats[i].type != type)
+			continue;
+		grants += stats[i].grants;
+		timeouts += stats[i].timeouts;
+		memcpy(&lat[n], stats[i].lat, stats[i].nr_lat * sizeof(*lat));
+		n += stats[i].nr_lat;
+	}
+	qsort(lat, n, sizeof(*lat), cmp_lat);
+
+	printf("%-7s grants %ld (%.1f/s), timeouts %ld\n", name, grants,
+	       grants / secs, timeouts);
+	printf("        acquire ms: p50 %.3f, p90 %.3f, p99 %.3f, "
+	       "max %.3f\n", lat_pct_ms(lat, n, 50), lat_pct_ms(lat, n, 90),
+	       lat_pct_ms(lat, n, 99), lat_pct_ms(lat, n, 100));
+	free(lat);
+}
+
+int main(int argc, char **argv)
+{
+	struct options opt = {
+		.readers = 4, .writers = 2, .seconds = 10, .rate_hz = 50,
+		.dist = DIST_UNIFORM, .range_deg = 20, .hold_us = 1000,
+	};
+	struct proc_stats *stats;
+	long long busy0 = 0, total0 = 0, busy1 = 0, total1 = 0;
+	int64_t start, end, worker_cpu = 0;
+	long grants = 0;
+	int nr_procs, c, i;
+	double secs;
+
+	while ((c = getopt(argc, argv, "r:w:t:f:D:R:H:")) != -1) {
+		switch (c) {
+		case 'r':
+			opt.readers = atoi(optarg);
+			break;
+		case 'w':
+			opt.writers = atoi(optarg);
+			break;
+		case 't':
+			opt.seconds = atoi(optarg);
+			break;
+		case 'f':
+			opt.rate_hz = atoi(optarg);
+			break;
+		case 'D':
+			if (strcmp(optarg, "fixed") == 0)
+				opt.dist = DIST_FIXED;
+			else if (strcmp(optarg, "uniform") == 0)
+				opt.dist = DIST_UNIFORM;
+			else
+				usage(argv[0]);
+			break;
+		case 'R':
+			opt.range_deg = atoi(optarg);
+			break;
+		case 'H':
+			opt.hold_us = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (opt.readers < 0 || opt.writers < 0 || opt.seconds < 1 ||
+	    opt.rate_hz < 1 || opt.range_deg < 1 || opt.hold_us < 0)
+		usage(argv[0]);
+
+	/* slot 0 is the driver */
+	nr_procs = 1 + opt.readers + opt.writers;
+	stats = mmap(NULL, nr_procs * sizeof(*stats), PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (stats == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < nr_procs; i++)
+		stats[i].type = i == 0 ? -1 : i <= opt.readers ?
+			READER_ENTRY : WRITER_ENTRY;
+
+	read_cpu_jiffies(&busy0, &total0);
+	start = now_ns();
+	end = start + opt.seconds * NSEC_PER_SEC;
+	for (i = 0; i < nr_procs; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+			break;
+		}
+		if (pid > 0)
+			continue;
+		if (i == 0)
+			run_driver(&opt, &stats[i], end);
+		else
+			run_worker(&opt, &stats[i], end);
+		_exit(EXIT_SUCCESS);
+	}
+	while (wait(NULL) > 0)
+		;
+	secs = (double) (now_ns() - start) / NSEC_PER_SEC;
+	read_cpu_jiffies(&busy1, &total1);
+
+	for (i = 1; i < nr_procs; i++) {
+		grants += stats[i].grants;
+		worker_cpu += stats[i].utime_ns + stats[i].stime_ns;
+	}
+
+	printf("%d readers, %d writers, %s ranges +/-%d deg, hold %d us, "
+	       "%.1f s\n", opt.readers, opt.writers,
+	       opt.dist == DIST_FIXED ? "fixed" : "uniform", opt.range_deg,
+	       opt.hold_us, secs);
+	printf("driver  %ld set_orientation calls (%.1f/s, asked %d/s)\n",
+	       stats[0].sets, stats[0].sets / secs, opt.rate_hz);
+	report_type("readers", READER_ENTRY, stats, nr_procs, secs);
+	report_type("writers", WRITER_ENTRY, stats, nr_procs, secs);
+	printf("total   grants %ld (%.1f/s)\n", grants, grants / secs);
+	printf("cpu     workers %.3f s (%.1f us/grant), driver %.3f s, "
+	       "system busy %.1f%%\n", worker_cpu / 1e9,
+	       grants ? worker_cpu / 1e3 / grants : 0.0,
+	       (stats[0].utime_ns + stats[0].stime_ns) / 1e9,
+	       total1 > total0 ?
+	       100.0 * (busy1 - busy0) / (total1 - total0) : 0.0);
+
+	munmap(stats, nr_procs * sizeof(*stats));
+	return EXIT_SUCCESS;
+}
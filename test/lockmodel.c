@@ -0,0 +1,323 @@
+/*
+ * lockmodel.c
+ *
+ * Replays an orientation trace (recorded with orientd -r) or a
+ * synthetic random walk against thousands of simulated lockers,
+ * using the host-side model of the lock engine, and reports grant
+ * latency and throughput. Runs on the build host, no emulator
+ * needed.
+ *
+ * Each locker asks for a lock on a random range, holds it for a
+ * number of samples once granted, releases it and asks again.
+ * Latencies are in trace time, throughput in both trace time and
+ * wall-clock time.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "orient_model.h"
+#include "../orientd/orient_trace.h"
+
+#define NSEC_PER_MSEC 1000000LL
+#define NSEC_PER_SEC 1000000000LL
+
+struct options {
+	int lockers;
+	int writer_pct;
+	double range_deg; /* widest +/- range a locker asks for */
+	int hold; /* samples a granted lock is held for */
+	int policy;
+	int max_bypass;
+	double deadband_deg;
+	long samples; /* synthetic walk length */
+	int period_ms; /* synthetic walk sample period */
+	const char *trace;
+};
+
+/* Where the orientations come from: a trace file or a random walk */
+struct source {
+	FILE *fp;
+	long left;
+	int64_t stamp;
+	int period_ms;
+	struct dev_orientation orient;
+};
+
+struct locker_state {
+	struct model_locker lock;
+	int hold_left;
+};
+
+static int64_t *latencies;
+static size_t nr_latencies, max_latencies;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t trace] [-n lockers] [-w writer%%] "
+		"[-r range_deg]\n"
+		"\t[-H hold_samples] [-p policy] [-b max_bypass] "
+		"[-d deadband_deg]\n"
+		"\t[-s samples] [-i period_ms]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+static double rand_between(double lo, double hi)
+{
+	return lo + (hi - lo) * (rand() / (RAND_MAX + 1.0));
+}
+
+/* A random angle in [lo, hi) degrees, as Q16 */
+static int rand_q16(double lo, double hi)
+{
+	double deg = rand_between(lo, hi);
+
+	return orient_from_float(deg);
+}
+
+static int source_open(struct source *src, struct options *opt)
+{
+	struct orient_trace_header hdr;
+
+	memset(src, 0, sizeof(*src));
+	src->left = opt->samples;
+	src->period_ms = opt->period_ms;
+	if (opt->trace == NULL)
+		return 0;
+
+	src->fp = fopen(opt->trace, "rb");
+	if (src->fp == NULL) {
+		perror(opt->trace);
+		return -1;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, src->fp) != 1 ||
+	    hdr.magic != ORIENT_TRACE_MAGIC ||
+	    hdr.version != ORIENT_TRACE_VERSION ||
+	    hdr.record_size != sizeof(struct orientation_sample)) {
+		fprintf(stderr, "%s is not an orientation trace\n",
+			opt->trace);
+		fclose(src->fp);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Produces the next orientation and its timestamp.
+ * Returns 0 once the trace or walk is over.
+ */
+static int source_next(struct source *src)
+{
+	struct dev_orientation *o = &src->orient;
+
+	if (src->fp != NULL) {
+		struct orientation_sample sample;
+
+		if (fread(&sample, sizeof(sample), 1, src->fp) != 1)
+			return 0;
+		src->stamp = sample.timestamp;
+		*o = sample.orient;
+		return 1;
+	}
+
+	if (src->left-- <= 0)
+		return 0;
+	src->stamp += src->period_ms * NSEC_PER_MSEC;
+	o->azimuth += rand_q16(-5, 5);
+	o->azimuth = normalize_azimuth(o->azimuth);
+	o->pitch += rand_q16(-3, 3);
+	if (o->pitch > ORIENT_DEG(180) || o->pitch < ORIENT_DEG(-180))
+		o->pitch = 0;
+	o->roll += rand_q16(-2, 2);
+	if (o->roll > ORIENT_DEG(90) || o->roll < ORIENT_DEG(-90))
+		o->roll = 0;
+	return 1;
+}
+
+/* Gives a locker a fresh random range and queues it */
+static void request(struct orient_model *model, struct locker_state *ls,
+		    struct options *opt, int64_t now)
+{
+	struct orientation_range *r = &ls->lock.range;
+
+	r->orient.azimuth = rand_q16(0, 360);
+	r->orient.pitch = rand_q16(-180, 180);
+	r->orient.roll = rand_q16(-90, 90);
+	r->azimuth_range = rand_q16(opt->range_deg / 2, opt->range_deg);
+	r->pitch_range = rand_q16(opt->range_deg / 2, opt->range_deg);
+	r->roll_range = rand_q16(opt->range_deg / 2, opt->range_deg);
+	ls->lock.ow.type = rand() % 100 < opt->writer_pct ?
+		WRITER_ENTRY : READER_ENTRY;
+	ls->hold_left = opt->hold;
+	model_request(model, &ls->lock, now);
+}
+
+static void record_latency(int64_t latency)
+{
+	if (nr_latencies == max_latencies) {
+		max_latencies = max_latencies ? 2 * max_latencies : 4096;
+		latencies = realloc(latencies,
+				    max_latencies * sizeof(*latencies));
+		if (latencies == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	latencies[nr_latencies++] = latency;
+}
+
+static int cmp_latency(const void *a, const void *b)
+{
+	int64_t one = *(const int64_t *) a, two = *(const int64_t *) b;
+
+	return one < two ? -1 : one > two;
+}
+
+static double percentile_ms(double pct)
+{
+	size_t i;
+
+	if (nr_latencies == 0)
+		return 0;
+	i = (size_t) (pct / 100 * (nr_latencies - 1) + 0.5);
+	return (double) latencies[i] / NSEC_PER_MSEC;
+}
+
+static double wall_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	struct options opt = {
+		.lockers = 1000, .writer_pct = 20, .range_deg = 30,
+		.hold = 5, .policy = ORIENTLOCK_FIFO, .max_bypass = 4,
+		.deadband_deg = 0, .samples = 100000, .period_ms = 20,
+		.trace = NULL,
+	};
+	struct orient_model model;
+	struct locker_state *lockers;
+	struct source src;
+	int64_t first_stamp = 0;
+	double start, wall;
+	int axis, c, i;
+
+	while ((c = getopt(argc, argv, "t:n:w:r:H:p:b:d:s:i:")) != -1) {
+		switch (c) {
+		case 't':
+			opt.trace = optarg;
+			break;
+		case 'n':
+			opt.lockers = atoi(optarg);
+			break;
+		case 'w':
+			opt.writer_pct = atoi(optarg);
+			break;
+		case 'r':
+			opt.range_deg = atof(optarg);
+			break;
+		case 'H':
+			opt.hold = atoi(optarg);
+			break;
+		case 'p':
+			opt.policy = atoi(optarg);
+			break;
+		case 'b':
+			opt.max_bypass = atoi(optarg);
+			break;
+		case 'd':
+			opt.deadband_deg = atof(optarg);
+			break;
+		case 's':
+			opt.samples = atol(optarg);
+			break;
+		case 'i':
+			opt.period_ms = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (opt.lockers < 1 || opt.range_deg <= 0 || opt.hold < 1)
+		usage(argv[0]);
+
+	srand(4118);
+	if (source_open(&src, &opt) < 0)
+		return EXIT_FAILURE;
+
+	lockers = calloc(opt.lockers, sizeof(*lockers));
+	if (lockers == NULL ||
+	    model_init(&model, opt.lockers, opt.policy, opt.max_bypass) < 0) {
+		perror("out of memory");
+		return EXIT_FAILURE;
+	}
+	for (axis = 0; axis < ORIENT_AXES; axis++)
+		model.deadband[axis] = orient_from_float(opt.deadband_deg);
+
+	start = wall_seconds();
+	while (source_next(&src)) {
+		/* Everyone asks as the trace starts */
+		if (model.samples == 0) {
+			first_stamp = src.stamp;
+			for (i = 0; i < opt.lockers; i++)
+				request(&model, &lockers[i], &opt, src.stamp);
+		}
+
+		/* Holders whose time is up release and ask again */
+		for (i = 0; i < opt.lockers; i++) {
+			struct locker_state *ls = &lockers[i];
+
+			if (ls->lock.state != MODEL_HOLDING ||
+			    --ls->hold_left > 0)
+				continue;
+			model_release(&model, &ls->lock);
+			request(&model, ls, &opt, src.stamp);
+		}
+
+		if (model_set_orientation(&model, &src.orient,
+					  src.stamp) == 0)
+			continue;
+		for (i = 0; i < opt.lockers; i++) {
+			struct locker_state *ls = &lockers[i];
+
+			if (ls->lock.state == MODEL_HOLDING &&
+			    ls->lock.granted_at == src.stamp &&
+			    ls->hold_left == opt.hold)
+				record_latency(ls->lock.granted_at -
+					       ls->lock.queued_at);
+		}
+	}
+	wall = wall_seconds() - start;
+
+	qsort(latencies, nr_latencies, sizeof(*latencies), cmp_latency);
+	printf("lockers %d, writers %d%%, ranges up to +/-%g deg, "
+	       "policy %d\n", opt.lockers, opt.writer_pct, opt.range_deg,
+	       opt.policy);
+	printf("samples %lu (%lu suppressed), passes %lu, "
+	       "%.1f waiters scanned/pass\n", model.samples, model.suppressed,
+	       model.passes,
+	       model.passes ? (double) model.scanned / model.passes : 0.0);
+	printf("grants %lu: %.1f/s trace time, %.0f/s wall time\n",
+	       model.grants, src.stamp > first_stamp ? model.grants *
+	       (double) NSEC_PER_SEC / (src.stamp - first_stamp) : 0.0,
+	       wall > 0 ? model.grants / wall : 0.0);
+	printf("grant latency ms: p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n",
+	       percentile_ms(50), percentile_ms(90), percentile_ms(99),
+	       percentile_ms(100));
+	printf("still waiting %d, wall time %.3f s (%.2f us/sample)\n",
+	       model.nr_waiters, wall,
+	       model.samples ? wall * 1e6 / model.samples : 0.0);
+
+	model_free(&model);
+	free(lockers);
+	free(latencies);
+	if (src.fp != NULL)
+		fclose(src.fp);
+	return EXIT_SUCCESS;
+}
@@ -15,8 +15,30 @@ __NR_orientlock_write
 __NR_orientunlock_read
 __NR_orientunlock_write
 __NR_orientlock_read
+__NR_get_orientation
+__NR_set_orientation
+__NR_orientlock_batch
+__NR_orientunlock_batch
+__NR_orientlock_tryread
+__NR_orientlock_trywrite
+__NR_orientlock_timedread
+__NR_orientlock_timedwrite
+__NR_orientlock_fd
  */
 
+/* Reads the current device orientation. Returns 0 on success */
+int orient_get(struct dev_orientation *orient)
+{
+	return syscall(__NR_get_orientation, orient);
+}
+
+/* Publishes a device orientation, as orientd does. Returns 0 on
+ * success */
+int orient_set(struct dev_orientation *orient)
+{
+	return syscall(__NR_set_orientation, orient);
+}
+
 /* Keeps on attempting to acquire a Read lock until we succeed */
 void orient_read_lock(struct orientation_range *lock)
 {
@@ -52,3 +74,58 @@ void orient_write_unlock(struct orientation_range *lock)
 		ret = syscall(__NR_orientunlock_write, lock);
 	} while (ret != 0);
 }
+
+/* Takes the read lock only if it is available right now.
+ * Returns 0 on success, -1 with errno EBUSY otherwise */
+int orient_read_trylock(struct orientation_range *lock)
+{
+	return syscall(__NR_orientlock_tryread, lock);
+}
+
+/* Takes the write lock only if it is available right now.
+ * Returns 0 on success, -1 with errno EBUSY otherwise */
+int orient_write_trylock(struct orientation_range *lock)
+{
+	return syscall(__NR_orientlock_trywrite, lock);
+}
+
+/* Waits at most timeout for the read lock. Returns 0 on success,
+ * -1 with errno ETIMEDOUT or EINTR otherwise */
+int orient_read_timedlock(struct orientation_range *lock,
+			  const struct timespec *timeout)
+{
+	return syscall(__NR_orientlock_timedread, lock, timeout);
+}
+
+/* Waits at most timeout for the write lock. Returns 0 on success,
+ * -1 with errno ETIMEDOUT or EINTR otherwise */
+int orient_write_timedlock(struct orientation_range *lock,
+			   const struct timespec *timeout)
+{
+	return syscall(__NR_orientlock_timedwrite, lock, timeout);
+}
+
+/* Queues a lock request of the given type (READER_ENTRY or
+ * WRITER_ENTRY) without waiting. Returns an fd that polls readable
+ * once the lock is granted, or -1 on error. Closing the fd releases
+ * the lock. flags may contain O_CLOEXEC and O_NONBLOCK */
+int orient_lock_fd(struct orientation_range *lock, int type, int flags)
+{
+	return syscall(__NR_orientlock_fd, lock, type, flags);
+}
+
+/* Acquires all the locks in reqs at once, waiting until they are
+ * all granted. Either every lock is granted or none is. Not retried:
+ * a malformed batch fails the same way every time. Returns 0 on
+ * success, -1 with errno EINVAL, EFAULT, ENOMEM or EINTR otherwise */
+int orient_lock_batch(struct orientlock_request *reqs, int count)
+{
+	return syscall(__NR_orientlock_batch, reqs, count);
+}
+
+/* Releases all the locks in reqs. Not retried: ranges that were
+ * held are released even if others were not. Returns 0 on success */
+int orient_unlock_batch(struct orientlock_request *reqs, int count)
+{
+	return syscall(__NR_orientunlock_batch, reqs, count);
+}
@@ -9,28 +9,63 @@
 #define ORIENT_LOCK_H_
 
 #include "../android-tegra-3.1/arch/arm/include/asm/unistd.h"
+#include <math.h>
 #include <unistd.h>
+#include <time.h>
 
 /* Include other struct needed to test program.
  * These were copied from include/linux/orientation.h
  */
+
+/* Angles are Q16 fixed point: degrees * ORIENT_ONE */
+#define ORIENT_FRAC_BITS 16
+#define ORIENT_ONE (1 << ORIENT_FRAC_BITS)
+#define ORIENT_DEG(deg) ((deg) * ORIENT_ONE)
+#define ORIENT_TO_FLOAT(q16) ((double) (q16) / ORIENT_ONE)
+
+/* Rounds as orientd's ORIENT_FROM_FLOAT does on the sensor's floats */
+static inline int orient_from_float(double deg)
+{
+	return (int) lrintf((float) deg * ORIENT_ONE);
+}
+
 struct dev_orientation {
 	int azimuth; /* angle between the magnetic north
 			and the Y axis, around the Z axis
-			(0<=azimuth<360)
+			(0<=azimuth<360), Q16
 			0=North, 90=East, 180=South, 270=West */
-	int pitch;   /* rotation around the X-axis: -180<=pitch<=180 */
+	int pitch;   /* rotation around the X-axis: -180<=pitch<=180, Q16 */
 	int roll;    /* rotation around Y-axis: +Y == -roll,
-			-90<=roll<=90 */
+			-90<=roll<=90, Q16 */
 };
 
 struct orientation_range {
 	struct dev_orientation orient;  /* device orientation */
-	unsigned int azimuth_range;     /* +/- degrees around Z-axis */
-	unsigned int pitch_range;       /* +/- degrees around X-axis */
-	unsigned int roll_range;        /* +/- degrees around Y-axis */
+	unsigned int azimuth_range;     /* +/- Q16 degrees around Z-axis */
+	unsigned int pitch_range;       /* +/- Q16 degrees around X-axis */
+	unsigned int roll_range;        /* +/- Q16 degrees around Y-axis */
+};
+
+/* Types of lock in a batched request */
+#define READER_ENTRY 0
+#define WRITER_ENTRY 1
+
+/* Most ranges a single batched request may carry */
+#define ORIENTLOCK_BATCH_MAX 32
+
+/* One element of a batched lock or unlock request */
+struct orientlock_request {
+	struct orientation_range range;
+	int type; /* READER_ENTRY or WRITER_ENTRY */
 };
 
+/* Reads the current device orientation. Returns 0 on success */
+int orient_get(struct dev_orientation *orient);
+
+/* Publishes a device orientation, as orientd does. Returns 0 on
+ * success */
+int orient_set(struct dev_orientation *orient);
+
 /* Keeps on attempting to acquire a Read lock until we succeed */
 void orient_read_lock(struct orientation_range *lock);
 
@@ -44,5 +79,38 @@ void orient_write_lock(struct orientation_range *lock);
 /* Keeps on attempting to release the write lock until we succeed */
 void orient_write_unlock(struct orientation_range *lock);
 
+/* Takes the read lock only if it is available right now.
+ * Returns 0 on success, -1 with errno EBUSY otherwise */
+int orient_read_trylock(struct orientation_range *lock);
+
+/* Takes the write lock only if it is available right now.
+ * Returns 0 on success, -1 with errno EBUSY otherwise */
+int orient_write_trylock(struct orientation_range *lock);
+
+/* Waits at most timeout for the read lock. Returns 0 on success,
+ * -1 with errno ETIMEDOUT or EINTR otherwise */
+int orient_read_timedlock(struct orientation_range *lock,
+			  const struct timespec *timeout);
+
+/* Waits at most timeout for the write lock. Returns 0 on success,
+ * -1 with errno ETIMEDOUT or EINTR otherwise */
+int orient_write_timedlock(struct orientation_range *lock,
+			   const struct timespec *timeout);
+
+/* Queues a lock request of the given type (READER_ENTRY or
+ * WRITER_ENTRY) without waiting. Returns an fd that polls readable
+ * once the lock is granted, or -1 on error. Closing the fd releases
+ * the lock. flags may contain O_CLOEXEC and O_NONBLOCK */
+int orient_lock_fd(struct orientation_range *lock, int type, int flags);
+
+/* Acquires all the locks in reqs at once, waiting until they are
+ * all granted. Either every lock is granted or none is. Not retried:
+ * a malformed batch fails the same way every time. Returns 0 on
+ * success, -1 with errno EINVAL, EFAULT, ENOMEM or EINTR otherwise */
+int orient_lock_batch(struct orientlock_request *reqs, int count);
+
+/* Releases all the locks in reqs. Not retried: ranges that were
+ * held are released even if others were not. Returns 0 on success */
+int orient_unlock_batch(struct orientlock_request *reqs, int count);
 
 #endif /* ORIENT_LOCK_H_ */
@@ -0,0 +1,248 @@
+/*
+ * orient_model.c
+ *
+ * Host-side model of the orientation lock engine, see orient_model.h.
+ * Each function mirrors the kernel function named in its comment;
+ * grant passes are the kernel's own, run through model_pass_ops.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "orient_model.h"
+
+int model_init(struct orient_model *model, int capacity, int policy,
+	       int max_bypass)
+{
+	memset(model, 0, sizeof(*model));
+	model->waiters = calloc(capacity, sizeof(*model->waiters));
+	model->holders = calloc(capacity, sizeof(*model->holders));
+	model->matches = calloc(capacity, sizeof(*model->matches));
+	if (model->waiters == NULL || model->holders == NULL ||
+	    model->matches == NULL) {
+		model_free(model);
+		return -1;
+	}
+	model->capacity = capacity;
+	model->policy = policy;
+	model->max_bypass = max_bypass < 1 ? 1 : max_bypass;
+	return 0;
+}
+
+void model_free(struct orient_model *model)
+{
+	free(model->waiters);
+	free(model->holders);
+	free(model->matches);
+	model->waiters = model->holders = model->matches = NULL;
+}
+
+static struct model_locker *locker_of(struct orient_waiter *w)
+{
+	return (struct model_locker *) ((char *) w -
+					offsetof(struct model_locker, ow));
+}
+
+/* Appends locker to an array of lockers, recording its slot */
+static void add_locker(struct model_locker **array, int *count,
+		       struct model_locker *locker)
+{
+	locker->slot = *count;
+	array[(*count)++] = locker;
+}
+
+/* Removes locker from an array of lockers, moving the last into its slot */
+static void remove_locker(struct model_locker **array, int *count,
+			  struct model_locker *locker)
+{
+	struct model_locker *last = array[--(*count)];
+
+	array[locker->slot] = last;
+	last->slot = locker->slot;
+}
+
+/* enqueue_waiters */
+void model_request(struct orient_model *model, struct model_locker *locker,
+		   int64_t now)
+{
+	set_range_bounds(&locker->ow.bounds, &locker->range);
+	locker->state = MODEL_WAITING;
+	locker->ow.seq = model->next_seq++;
+	locker->ow.bypassed = 0;
+	locker->ow.overtaken = 0;
+	locker->starved = 0;
+	locker->queued_at = now;
+	add_locker(model->waiters, &model->nr_waiters, locker);
+	model->changed = 1;
+}
+
+/* release_lock and withdraw_waiter */
+void model_release(struct orient_model *model, struct model_locker *locker)
+{
+	if (locker->state == MODEL_HOLDING)
+		remove_locker(model->holders, &model->nr_holders, locker);
+	else if (locker->state == MODEL_WAITING)
+		remove_locker(model->waiters, &model->nr_waiters, locker);
+	locker->state = MODEL_IDLE;
+	model->changed = 1;
+}
+
+/* Policy for match_cmp; qsort takes no context argument */
+static int match_policy;
+
+/* waiter_policy_cmp */
+static int match_cmp(const void *a, const void *b)
+{
+	struct model_locker *one = *(struct model_locker * const *) a;
+	struct model_locker *two = *(struct model_locker * const *) b;
+
+	return policy_cmp(match_policy, &one->ow, &two->ow);
+}
+
+/* pass_next_match */
+static struct orient_waiter *model_next_match(void *pass)
+{
+	struct orient_model *model = pass;
+
+	if (model->next_match == model->nr_matches)
+		return NULL;
+	return &model->matches[model->next_match++]->ow;
+}
+
+/* pass_next_pending: the matches still waiting */
+static struct orient_waiter *model_next_pending(void *pass,
+						struct orient_waiter *prev)
+{
+	struct orient_model *model = pass;
+	int i = prev ? locker_of(prev)->match + 1 : 0;
+
+	for (; i < model->nr_matches; i++) {
+		if (model->matches[i]->state == MODEL_WAITING)
+			return &model->matches[i]->ow;
+	}
+	return NULL;
+}
+
+/* pass_next_starved, by scanning every waiter */
+static struct orient_waiter *model_next_starved(void *pass,
+						struct orient_waiter *prev)
+{
+	struct orient_model *model = pass;
+	int i = prev ? locker_of(prev)->slot + 1 : 0;
+
+	for (; i < model->nr_waiters; i++) {
+		if (model->waiters[i]->starved)
+			return &model->waiters[i]->ow;
+	}
+	return NULL;
+}
+
+/* pass_holders_conflict, by scanning every holder */
+static int model_holders_conflict(void *pass, struct orient_waiter *w)
+{
+	struct orient_model *model = pass;
+	int i;
+
+	for (i = 0; i < model->nr_holders; i++) {
+		if (waiters_conflict(&model->holders[i]->ow, w))
+			return 1;
+	}
+	return 0;
+}
+
+/* pass_grant */
+static void model_grant(void *pass, struct orient_waiter *w)
+{
+	struct orient_model *model = pass;
+	struct model_locker *locker = locker_of(w);
+
+	remove_locker(model->waiters, &model->nr_waiters, locker);
+	add_locker(model->holders, &model->nr_holders, locker);
+	locker->state = MODEL_HOLDING;
+	locker->granted_at = model->now;
+}
+
+/* pass_starve */
+static void model_starve(void *pass, struct orient_waiter *w)
+{
+	locker_of(w)->starved = 1;
+}
+
+/* pass_edges_around, by scanning every waiter's edges */
+static void model_edges_around(void *pass, int axis, int value, int *below,
+			       int *above)
+{
+	struct orient_model *model = pass;
+	int edge, i, v;
+
+	for (i = 0; i < model->nr_waiters; i++) {
+		for (edge = 2 * axis; edge < 2 * axis + 2; edge++) {
+			if (!bounds_edge(&model->waiters[i]->ow.bounds, edge,
+					 &v))
+				continue;
+			if (v <= value && v > *below)
+				*below = v;
+			if (v > value && v < *above)
+				*above = v;
+		}
+	}
+}
+
+/* Batched requests are not modelled, nor is publishing a grant */
+static const struct orient_pass_ops model_pass_ops = {
+	.next_match = model_next_match,
+	.next_pending = model_next_pending,
+	.next_starved = model_next_starved,
+	.holders_conflict = model_holders_conflict,
+	.grant = model_grant,
+	.starve = model_starve,
+	.edges_around = model_edges_around,
+};
+
+/* orientation_grant_pass */
+static int grant_pass(struct orient_model *model,
+		      struct dev_orientation *orient, int64_t now)
+{
+	int granted, i;
+
+	model->nr_matches = 0;
+	for (i = 0; i < model->nr_waiters; i++) {
+		if (in_bounds(&model->waiters[i]->ow.bounds, orient))
+			model->matches[model->nr_matches++] =
+				model->waiters[i];
+	}
+	model->scanned += model->nr_waiters;
+
+	match_policy = model->policy;
+	qsort(model->matches, model->nr_matches, sizeof(*model->matches),
+	      match_cmp);
+	for (i = 0; i < model->nr_matches; i++)
+		model->matches[i]->match = i;
+
+	model->next_match = 0;
+	model->now = now;
+	granted = grant_waiters(&model_pass_ops, model, orient,
+				model->max_bypass);
+	compute_cell(&model_pass_ops, model, orient, &model->cell);
+	model->cell_valid = 1;
+
+	model->passes++;
+	model->grants += granted;
+	return granted;
+}
+
+/* publish_orientation */
+int model_set_orientation(struct orient_model *model,
+			  struct dev_orientation *orient, int64_t now)
+{
+	struct dev_orientation korient = *orient;
+
+	korient.azimuth = normalize_azimuth(korient.azimuth);
+	model->samples++;
+
+	if (!model->changed && model->cell_valid &&
+	    in_cell(&model->cell, &korient, model->deadband)) {
+		model->suppressed++;
+		return 0;
+	}
+	model->changed = 0;
+	return grant_pass(model, &korient, now);
+}
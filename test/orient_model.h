@@ -0,0 +1,83 @@
+/*
+ * orient_model.h
+ *
+ * Host-side model of the orientation lock engine. Grant passes run
+ * the kernel's own engine
+ * (android-tegra-3.1/include/linux/orientation_core.h) over plain
+ * arrays instead of the kernel's trees, shards and locks, so lock
+ * behaviour can be replayed on any Linux box.
+ */
+
+#ifndef ORIENT_MODEL_H_
+#define ORIENT_MODEL_H_
+
+#include <stdint.h>
+#include "orient_lock.h"
+#include "../android-tegra-3.1/include/linux/orientation_core.h"
+
+/* States of a model_locker */
+#define MODEL_IDLE 0
+#define MODEL_WAITING 1
+#define MODEL_HOLDING 2
+
+/* One lock request, reused for every lock its owner takes */
+struct model_locker {
+	struct orientation_range range;
+	struct orient_waiter ow; /* set ow.type before model_request() */
+	int state;
+	int starved; /* bypassed at least max_bypass times */
+	int slot; /* index in the model's waiters or holders */
+	int match; /* index in matches during a grant pass */
+	int64_t queued_at; /* model time in ns, set by model_request */
+	int64_t granted_at;
+};
+
+struct orient_model {
+	struct model_locker **waiters; /* in no order */
+	int nr_waiters;
+	struct model_locker **holders;
+	int nr_holders;
+	int capacity; /* size of waiters and holders */
+	struct model_locker **matches; /* scratch for a grant pass */
+	int nr_matches;
+	int next_match; /* first match the pass has not considered */
+	int64_t now; /* model time of the running pass */
+
+	int policy; /* ORIENTLOCK_FIFO, _WRITER_PREF or _READER_PREF */
+	int max_bypass;
+	int deadband[ORIENT_AXES]; /* Q16 */
+
+	struct orient_cell cell; /* see grant_cell in the kernel */
+	int cell_valid;
+	int changed; /* waiters or holders changed since the last pass */
+	unsigned long next_seq;
+
+	unsigned long samples; /* orientations published */
+	unsigned long passes; /* grant passes run */
+	unsigned long suppressed; /* samples that needed no pass */
+	unsigned long scanned; /* waiters looked at by passes */
+	unsigned long grants;
+};
+
+/* Sets up a model for at most capacity concurrent requests.
+ * Returns 0 on success, -1 if out of memory */
+int model_init(struct orient_model *model, int capacity, int policy,
+	       int max_bypass);
+
+void model_free(struct orient_model *model);
+
+/* Queues locker's request at model time now (ns). The locker
+ * must be idle and its range and type set */
+void model_request(struct orient_model *model, struct model_locker *locker,
+		   int64_t now);
+
+/* Releases a held lock or withdraws a waiting request */
+void model_release(struct orient_model *model, struct model_locker *locker);
+
+/* Publishes an orientation at model time now and runs a grant pass
+ * unless, as in the kernel, the sample cannot change any grant.
+ * Returns the number of locks granted */
+int model_set_orientation(struct orient_model *model,
+			  struct dev_orientation *orient, int64_t now);
+
+#endif /* ORIENT_MODEL_H_ */
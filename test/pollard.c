@@ -3,33 +3,163 @@
 #include <math.h>
 #include <stdarg.h>
 #include <gmp.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "prime.h"
 #include "orient_lock.h"
 
 #define FILENAME "integer"
 
+/* Most worker threads pollard -j takes */
+#define RHO_MAX_THREADS 16
+
 static mpz_t one;
 static mpz_t two;
 static gmp_randstate_t randstate;
 
-static void rho(mpz_t R, mpz_t N)
+/* Worker threads for parallel rho; 1 walks on the calling thread */
+static int rho_threads = 1;
+
+/* Steps multiplied together between gcds in brent_walk() */
+#define RHO_BATCH 128
+
+/* One step of the walk: y = y^2 + c mod N, with a single reduction */
+static inline void rho_step(mpz_t y, mpz_t c, mpz_t N)
 {
-	mpz_t divisor;
-	mpz_t c;
-	mpz_t x;
-	mpz_t xx;
-	mpz_t abs;
+	mpz_mul(y, y, y);
+	mpz_add(y, y, c);
+	mpz_mod(y, y, N);
+}
+
+/*
+ * Brent's variant of rho from x0 with constant c. The differences
+ * |x - y| are multiplied together mod N and only their product is
+ * gcd'ed with N, once per RHO_BATCH steps. If a batch overshoots to
+ * a gcd of N, its steps are redone one gcd at a time. Gives up when
+ * *stop becomes nonzero, checked every RHO_BATCH steps.
+ * Returns 1 with a non-trivial divisor in R, or 0 if this c failed.
+ */
+static int brent_walk(mpz_t R, mpz_t N, mpz_t c, mpz_t x0,
+		      volatile int *stop)
+{
+	mpz_t x, y, ys, q, diff;
+	unsigned long r, k, i, m;
+	int found = 0;
 
-	mpz_init(divisor);
-	mpz_init(c);
 	mpz_init(x);
-	mpz_init(xx);
-	mpz_init(abs);
+	mpz_init_set(y, x0);
+	mpz_init(ys);
+	mpz_init_set_ui(q, 1);
+	mpz_init(diff);
+	mpz_set_ui(R, 1);
+
+	for (r = 1; mpz_cmp_ui(R, 1) == 0; r *= 2) {
+		mpz_set(x, y);
+		for (i = 0; i < r; i++) {
+			if (i % RHO_BATCH == 0 && *stop)
+				goto out;
+			rho_step(y, c, N);
+		}
+
+		for (k = 0; k < r && mpz_cmp_ui(R, 1) == 0; k += m) {
+			if (*stop)
+				goto out;
+			mpz_set(ys, y);
+			m = r - k < RHO_BATCH ? r - k : RHO_BATCH;
+			for (i = 0; i < m; i++) {
+				rho_step(y, c, N);
+				mpz_sub(diff, x, y);
+				mpz_mul(q, q, diff);
+				mpz_mod(q, q, N);
+			}
+			mpz_gcd(R, q, N);
+		}
+	}
+
+	/* the batch ran into a multiple of N, redo it step by step */
+	if (mpz_cmp(R, N) == 0) {
+		do {
+			rho_step(ys, c, N);
+			mpz_sub(diff, x, ys);
+			mpz_gcd(R, diff, N);
+		} while (mpz_cmp_ui(R, 1) == 0);
+	}
+	found = mpz_cmp(R, N) != 0;
+out:
+	mpz_clear(x);
+	mpz_clear(y);
+	mpz_clear(ys);
+	mpz_clear(q);
+	mpz_clear(diff);
+	return found;
+}
+
+/* Picks a random walk: c not in {0, N - 2}, and a start value */
+static void pick_walk(mpz_t c, mpz_t x0, mpz_t N, gmp_randstate_t state)
+{
+	do {
+		mpz_urandomm(c, state, N);
+		mpz_add_ui(x0, c, 2);
+	} while (mpz_sgn(c) == 0 || mpz_cmp(x0, N) == 0);
+	mpz_urandomm(x0, state, N);
+}
+
+/* Shared by the threads of one parallel rho() */
+struct rho_race {
+	mpz_ptr N;
+	mpz_ptr R; /* first divisor found */
+	volatile int stop; /* set once R holds a divisor */
+	pthread_mutex_t lock; /* protects R and stop */
+	unsigned long seed;
+};
+
+/* Runs independent walks until this or another thread finds a divisor */
+static void *rho_worker(void *arg)
+{
+	struct rho_race *race = arg;
+	gmp_randstate_t state;
+	mpz_t c, x0, divisor;
+
+	gmp_randinit_default(state);
+	pthread_mutex_lock(&race->lock);
+	gmp_randseed_ui(state, race->seed++);
+	pthread_mutex_unlock(&race->lock);
+	mpz_init(c);
+	mpz_init(x0);
+	mpz_init(divisor);
+
+	while (!race->stop) {
+		pick_walk(c, x0, race->N, state);
+		if (!brent_walk(divisor, race->N, c, x0, &race->stop))
+			continue;
+
+		pthread_mutex_lock(&race->lock);
+		if (!race->stop) {
+			mpz_set(race->R, divisor);
+			race->stop = 1;
+		}
+		pthread_mutex_unlock(&race->lock);
+	}
 
-	mpz_urandomm(c, randstate, N);
-	mpz_urandomm(x, randstate, N);
-	mpz_set(xx, x);
+	mpz_clear(c);
+	mpz_clear(x0);
+	mpz_clear(divisor);
+	gmp_randclear(state);
+	return NULL;
+}
 
+/*
+ * Finds a non-trivial divisor of the composite N. With rho_threads
+ * above 1, that many threads race walks with different c values
+ * and the first divisor found wins.
+ */
+static void rho(mpz_t R, mpz_t N)
+{
+	static int stop; /* never set, serial walks run until they succeed */
+	struct rho_race race;
+	pthread_t threads[RHO_MAX_THREADS];
+	mpz_t c, x0;
+	int i, started = 0;
 
 	/* check divisibility by 2 */
 	if (mpz_divisible_p(N, two)) {
@@ -37,31 +167,32 @@ static void rho(mpz_t R, mpz_t N)
 		return;
 	}
 
+	if (rho_threads > 1) {
+		race.N = N;
+		race.R = R;
+		race.stop = 0;
+		race.seed = gmp_urandomb_ui(randstate, 32);
+		pthread_mutex_init(&race.lock, NULL);
+		for (i = 0; i < rho_threads; i++) {
+			if (pthread_create(&threads[i], NULL, rho_worker,
+					   &race) == 0)
+				started++;
+		}
+		for (i = 0; i < started; i++)
+			pthread_join(threads[i], NULL);
+		pthread_mutex_destroy(&race.lock);
+		if (started > 0)
+			return;
+	}
+
+	/* single threaded, or no thread could be started */
+	mpz_init(c);
+	mpz_init(x0);
 	do {
-		/* Do this with x */
-		mpz_mul(x, x, x);
-		mpz_mod(x, x, N);
-		mpz_add(x, x, c);
-		mpz_mod(x, x, N);
-
-		/* First time with xx */
-		mpz_mul(xx, xx, xx);
-		mpz_mod(xx, xx, N);
-		mpz_add(xx, xx, c);
-		mpz_mod(xx, xx, N);
-
-		/* Second time with xx */
-		mpz_mul(xx, xx, xx);
-		mpz_mod(xx, xx, N);
-		mpz_add(xx, xx, c);
-		mpz_mod(xx, xx, N);
-
-		mpz_sub(abs, x, xx);
-		mpz_abs(abs, abs);
-		mpz_gcd(divisor, abs, N);
-	} while (mpz_cmp(divisor, one) == 0);
-
-	mpz_set(R, divisor);
+		pick_walk(c, x0, N, randstate);
+	} while (!brent_walk(R, N, c, x0, &stop));
+	mpz_clear(c);
+	mpz_clear(x0);
 }
 
 static void factor(mpz_t N)
@@ -159,14 +290,14 @@ static int read_integer(mpz_ptr result)
 	/* get read lock - only want to work when device is lying facedown */
 	struct orientation_range read_lock;
 	struct dev_orientation read_lock_orient;
-	read_lock_orient.azimuth = 180;
-	read_lock_orient.pitch = 180;
-	read_lock_orient.roll = 0;
+	read_lock_orient.azimuth = ORIENT_DEG(180);
+	read_lock_orient.pitch = ORIENT_DEG(180);
+	read_lock_orient.roll = ORIENT_DEG(0);
 
 	read_lock.orient = read_lock_orient;
-	read_lock.azimuth_range =  180;
-	read_lock.roll_range = 10;
-	read_lock.pitch_range = 10;
+	read_lock.azimuth_range =  ORIENT_DEG(180);
+	read_lock.roll_range = ORIENT_DEG(10);
+	read_lock.pitch_range = ORIENT_DEG(10);
 
 	printf("Attempting to take read lock...");
 	orient_read_lock(&read_lock);
@@ -193,12 +324,30 @@ static int read_integer(mpz_ptr result)
 	return ret_code;
 }
 
-int main(void)
+/*
+ * pollard [-j threads]: runs rho walks on that many threads, by
+ * default one per online CPU. -j 1 factors on the main thread only.
+ */
+int main(int argc, char **argv)
 {
 	int res;
 	char *str;
 	mpz_t largenum;
 	mpz_t result;
+	int opt;
+
+	rho_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "j:")) != -1) {
+		if (opt != 'j') {
+			fprintf(stderr, "usage: %s [-j threads]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		rho_threads = atoi(optarg);
+	}
+	if (rho_threads < 1)
+		rho_threads = 1;
+	if (rho_threads > RHO_MAX_THREADS)
+		rho_threads = RHO_MAX_THREADS;
 
 	mpz_init_set_str(one, "1", 10);
 	mpz_init_set_str(two, "2", 10);
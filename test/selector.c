@@ -66,14 +66,14 @@ int main(int argc, char **argv)
 	struct orientation_range write_lock;
 	/* Only want this to work when device is lying facedown */
 	struct dev_orientation write_lock_orient;
-	write_lock_orient.azimuth = 180;
-	write_lock_orient.pitch = 180;
-	write_lock_orient.roll = 0;
+	write_lock_orient.azimuth = ORIENT_DEG(180);
+	write_lock_orient.pitch = ORIENT_DEG(180);
+	write_lock_orient.roll = ORIENT_DEG(0);
 
 	write_lock.orient = write_lock_orient;
-	write_lock.azimuth_range =  180;
-	write_lock.roll_range = 10;
-	write_lock.pitch_range = 10;
+	write_lock.azimuth_range =  ORIENT_DEG(180);
+	write_lock.roll_range = ORIENT_DEG(10);
+	write_lock.pitch_range = ORIENT_DEG(10);
 
 	const char *filename = FILENAME;
 
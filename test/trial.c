@@ -114,14 +114,14 @@ static int read_integer(mpz_ptr result)
 	/* get read lock - only want to work when device is lying facedown */
 	struct orientation_range read_lock;
 	struct dev_orientation read_lock_orient;
-	read_lock_orient.azimuth = 180;
-	read_lock_orient.pitch = 180;
-	read_lock_orient.roll = 0;
+	read_lock_orient.azimuth = ORIENT_DEG(180);
+	read_lock_orient.pitch = ORIENT_DEG(180);
+	read_lock_orient.roll = ORIENT_DEG(0);
 
 	read_lock.orient = read_lock_orient;
-	read_lock.azimuth_range =  180;
-	read_lock.roll_range = 10;
-	read_lock.pitch_range = 10;
+	read_lock.azimuth_range =  ORIENT_DEG(180);
+	read_lock.roll_range = ORIENT_DEG(10);
+	read_lock.pitch_range = ORIENT_DEG(10);
 
 	printf("Attempting to take read lock...");
 	orient_read_lock(&read_lock);